@@ -25,31 +25,38 @@
  *      in aesd_buffer.
  * @return the struct aesd_buffer_entry structure representing the position described by char_offset, or
  * NULL if this position is not available in the buffer (not enough data is written).
+ * Entry offsets increase from out_offs, so this is a binary search.
  */
 struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn )
 {
-    size_t total_size = 0;
-    size_t buffer_full_start = buffer->full;
+    uint32_t lo = 0;
+    uint32_t hi = aesd_circular_buffer_count(buffer);
+    struct aesd_buffer_entry *entry;
 
-    for (uint8_t i = buffer->out_offs; (i != buffer->in_offs) || buffer_full_start; i = (++i % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED == 0) ? 0 : i)
+    if (char_offset >= aesd_circular_buffer_size(buffer))
     {
-        total_size += buffer->entry[i].size;
-        if (char_offset < total_size)
+        return NULL;
+    }
+
+    // Find the last entry starting at or before char_offset; entry lo always qualifies
+    while (hi - lo > 1)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        entry = aesd_circular_buffer_nth(buffer, mid);
+        if (aesd_circular_buffer_entry_fpos(buffer, entry) <= char_offset)
         {
-            // Found the entry
-            size_t entry_start_offset = total_size - buffer->entry[i].size;
-            *entry_offset_byte_rtn = char_offset - entry_start_offset;
-            return &buffer->entry[i];
+            lo = mid;
         }
-
-        // Clear full flag after first iteration if set
-        if (buffer_full_start)
+        else
         {
-            buffer_full_start = 0;
+            hi = mid;
         }
     }
-    return NULL;
+
+    entry = aesd_circular_buffer_nth(buffer, lo);
+    *entry_offset_byte_rtn = char_offset - aesd_circular_buffer_entry_fpos(buffer, entry);
+    return entry;
 }
 
 /**
@@ -64,21 +71,93 @@ void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer, const s
     if (buffer->full)
     {
         // Overwrite the oldest entry, advance out_offs
-        buffer->out_offs = (buffer->out_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+        buffer->start_offset += buffer->entry[buffer->out_offs].size;
+        buffer->start_seq++;
+        buffer->out_offs = aesd_circular_buffer_wrap(buffer, buffer->out_offs + 1);
     }
 
     buffer->entry[buffer->in_offs] = *add_entry;
-    buffer->in_offs = (buffer->in_offs + 1) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->entry[buffer->in_offs].offset = buffer->end_offset;
+    buffer->end_offset += add_entry->size;
+    buffer->in_offs = aesd_circular_buffer_wrap(buffer, buffer->in_offs + 1);
     if (buffer->in_offs == buffer->out_offs)
     {
         buffer->full = true;
     }
 }
 
+/**
+* Removes the oldest entry from @param buffer.
+* Any necessary locking must be handled by the caller
+* @return the removed entry, valid until the next call to aesd_circular_buffer_add_entry(), or NULL
+* if the buffer is empty.  Memory referenced by the entry is still owned by the caller.
+*/
+struct aesd_buffer_entry *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer)
+{
+    struct aesd_buffer_entry *oldest;
+
+    if (!buffer->full && buffer->in_offs == buffer->out_offs)
+    {
+        return NULL;
+    }
+
+    oldest = &buffer->entry[buffer->out_offs];
+    buffer->start_offset += oldest->size;
+    buffer->start_seq++;
+    buffer->out_offs = aesd_circular_buffer_wrap(buffer, buffer->out_offs + 1);
+    buffer->full = false;
+    return oldest;
+}
+
 /**
 * Initializes the circular buffer described by @param buffer to an empty struct
+* holding AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
 */
 void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer)
 {
     memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    buffer->entry = buffer->entry_inline;
+    buffer->capacity = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+    buffer->mask = 0;
+}
+
+/**
+* Initializes @param buffer to an empty struct using caller allocated @param storage of
+* @param capacity entries.  Power of two capacities use masking for index math.
+*/
+void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity)
+{
+    memset(buffer,0,sizeof(struct aesd_circular_buffer));
+    memset(storage,0,sizeof(struct aesd_buffer_entry) * capacity);
+    buffer->entry = storage;
+    buffer->capacity = capacity;
+    buffer->mask = aesd_ring_mask(capacity);
+}
+
+/**
+* Moves the entries of @param buffer, oldest first, into @param storage of @param capacity entries.
+* The caller must first remove entries until no more than @param capacity remain, and owns
+* (and frees, unless it is entry_inline) the previous storage.
+* Any necessary locking must be handled by the caller
+*/
+void aesd_circular_buffer_migrate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity)
+{
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    struct aesd_buffer_entry *entry;
+    uint32_t i;
+
+    memset(storage,0,sizeof(struct aesd_buffer_entry) * capacity);
+    AESD_CIRCULAR_BUFFER_FOREACH_LIVE(entry, buffer, i)
+    {
+        storage[i] = *entry;
+    }
+
+    buffer->entry = storage;
+    buffer->capacity = capacity;
+    buffer->mask = aesd_ring_mask(capacity);
+    buffer->out_offs = 0;
+    buffer->in_offs = aesd_circular_buffer_wrap(buffer, count);
+    buffer->full = (count == capacity);
 }
@@ -16,6 +16,11 @@
 #include <stdbool.h>
 #endif
 
+#include "aesd-ring.h"
+
+/**
+ * Default capacity, used by aesd_circular_buffer_init()
+ */
 #define AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED 10
 
 struct aesd_buffer_entry
@@ -28,29 +33,108 @@ struct aesd_buffer_entry
      * Number of bytes stored in buffptr
      */
     size_t size;
+    /**
+     * Position of the first byte of buffptr in the stream of every byte ever added to the buffer.
+     * Set by aesd_circular_buffer_add_entry()
+     */
+    size_t offset;
+    /**
+     * When the entry was committed, in ns.  Kept for the owner of the buffer, which sets it
+     */
+    uint64_t timestamp;
 };
 
 struct aesd_circular_buffer
 {
     /**
-     * An array of pointers to memory allocated for the most recent write operations
+     * An array of pointers to memory allocated for the most recent write operations.
+     * Points at entry_inline unless storage was supplied with aesd_circular_buffer_init_storage()
+     */
+    struct aesd_buffer_entry *entry;
+    /**
+     * Number of slots in entry
      */
-    struct aesd_buffer_entry  entry[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
+    uint32_t capacity;
+    /**
+     * capacity - 1 when capacity is a power of two so index math is a mask, otherwise 0
+     */
+    uint32_t mask;
     /**
      * The current location in the entry structure where the next write should
      * be stored.
      */
-    uint8_t in_offs;
+    uint32_t in_offs;
     /**
      * The first location in the entry structure to read from
      */
-    uint8_t out_offs;
+    uint32_t out_offs;
     /**
      * set to true when the buffer entry structure is full
      */
     bool full;
+    /**
+     * Stream position of the oldest byte still in the buffer (the offset of entry[out_offs])
+     */
+    size_t start_offset;
+    /**
+     * Stream position one past the newest byte in the buffer (the offset of the next entry added)
+     */
+    size_t end_offset;
+    /**
+     * Sequence number of entry[out_offs], counting every entry ever added to the buffer
+     */
+    uint64_t start_seq;
+    /**
+     * Default storage for AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED entries
+     */
+    struct aesd_buffer_entry entry_inline[AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED];
 };
 
+/**
+ * @return the slot index for offs, where offs is a slot index plus at most capacity
+ */
+static inline uint32_t aesd_circular_buffer_wrap(const struct aesd_circular_buffer *buffer, uint32_t offs)
+{
+    return aesd_ring_wrap(offs, buffer->capacity, buffer->mask);
+}
+
+/**
+ * @return the number of valid entries in @param buffer
+ */
+static inline uint32_t aesd_circular_buffer_count(const struct aesd_circular_buffer *buffer)
+{
+    if (buffer->full)
+        return buffer->capacity;
+    return aesd_circular_buffer_wrap(buffer, buffer->in_offs + buffer->capacity - buffer->out_offs);
+}
+
+/**
+ * @return the total number of bytes held by valid entries in @param buffer
+ */
+static inline size_t aesd_circular_buffer_size(const struct aesd_circular_buffer *buffer)
+{
+    return buffer->end_offset - buffer->start_offset;
+}
+
+/**
+ * @return the char_offset of the first byte of @param entry, a valid entry in @param buffer
+ */
+static inline size_t aesd_circular_buffer_entry_fpos(const struct aesd_circular_buffer *buffer,
+            const struct aesd_buffer_entry *entry)
+{
+    return entry->offset - buffer->start_offset;
+}
+
+/**
+ * @return the entry @param n places after the oldest in @param buffer, whose sequence number
+ * is start_seq + @param n.  @param n must be less than the entry count
+ */
+static inline struct aesd_buffer_entry *aesd_circular_buffer_nth(const struct aesd_circular_buffer *buffer,
+            uint32_t n)
+{
+    return &buffer->entry[aesd_circular_buffer_wrap(buffer, buffer->out_offs + n)];
+}
+
 extern struct aesd_buffer_entry *aesd_circular_buffer_find_entry_offset_for_fpos(struct aesd_circular_buffer *buffer,
             size_t char_offset, size_t *entry_offset_byte_rtn );
 
@@ -58,14 +142,22 @@ extern void aesd_circular_buffer_add_entry(struct aesd_circular_buffer *buffer,
 
 extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
 
+extern void aesd_circular_buffer_init_storage(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity);
+
+extern void aesd_circular_buffer_migrate(struct aesd_circular_buffer *buffer,
+            struct aesd_buffer_entry *storage, uint32_t capacity);
+
+extern struct aesd_buffer_entry *aesd_circular_buffer_remove_entry(struct aesd_circular_buffer *buffer);
+
 /**
- * Create a for loop to iterate over each member of the circular buffer.
+ * Create a for loop to iterate over each slot of the circular buffer, valid or not.
  * Useful when you've allocated memory for circular buffer entries and need to free it
  * @param entryptr is a struct aesd_buffer_entry* to set with the current entry
  * @param buffer is the struct aesd_buffer * describing the buffer
- * @param index is a uint8_t stack allocated value used by this macro for an index
+ * @param index is a uint32_t stack allocated value used by this macro for an index
  * Example usage:
- * uint8_t index;
+ * uint32_t index;
  * struct aesd_circular_buffer buffer;
  * struct aesd_buffer_entry *entry;
  * AESD_CIRCULAR_BUFFER_FOREACH(entry,&buffer,index) {
@@ -74,9 +166,20 @@ extern void aesd_circular_buffer_init(struct aesd_circular_buffer *buffer);
  */
 #define AESD_CIRCULAR_BUFFER_FOREACH(entryptr,buffer,index) \
     for(index=0, entryptr=&((buffer)->entry[index]); \
-            index<AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED; \
+            index<(buffer)->capacity; \
             index++, entryptr=&((buffer)->entry[index]))
 
+/**
+ * Create a for loop to iterate over the valid entries of the circular buffer, oldest first.
+ * @param index counts from 0 and is the entry's sequence number less start_seq.
+ * The buffer must not change during the loop.
+ */
+#define AESD_CIRCULAR_BUFFER_FOREACH_LIVE(entryptr,buffer,index) \
+    for(index=0; \
+            index<aesd_circular_buffer_count(buffer) && \
+            ((entryptr=aesd_circular_buffer_nth((buffer),index)), true); \
+            index++)
+
 
 
 #endif /* AESD_CIRCULAR_BUFFER_H */
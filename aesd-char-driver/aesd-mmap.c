@@ -0,0 +1,227 @@
+/**
+ * @file aesd-mmap.c
+ * @brief Read-only mapping of the aesdchar history, see aesd_mmap.h for the layout
+ *
+ * The mapped area mirrors the circular buffer: the entry table has one slot per ring
+ * slot and the data ring holds the newest data_size bytes of the stream.  It is
+ * updated by writers under dev->lock and rebuilt when the ring is resized.  Each
+ * mapping holds a reference, so a replaced area lives until it is unmapped.
+ *
+ * The data ring is a second copy of the history, not a mapping of the device's byte
+ * ring: that ring keeps every entry contiguous by skipping to its start, so a stream
+ * offset has no fixed place in it.  The cost is mmap_data_bytes of vmalloc memory
+ * per device, and every write is copied twice under dev->lock.
+ */
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include "aesdchar.h"
+
+static void aesd_mmap_write_begin(struct aesd_mmap_header *hdr)
+{
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+    smp_wmb();
+}
+
+static void aesd_mmap_write_end(struct aesd_mmap_header *hdr)
+{
+    smp_wmb();
+    WRITE_ONCE(hdr->seq, hdr->seq + 1);
+}
+
+/**
+ * Copy @param len bytes that belong at stream offset @param pos into the data ring.
+ * @param len must not exceed data_size.
+ */
+static void aesd_mmap_copy(struct aesd_mmap_area *area, uint64_t pos, const char *src, size_t len)
+{
+    size_t data_size = area->hdr->data_size;
+    size_t at, n;
+
+    while (len) {
+        at = pos & (data_size - 1);
+        n = min(len, data_size - at);
+        memcpy(area->data + at, src, n);
+        pos += n;
+        src += n;
+        len -= n;
+    }
+}
+
+/**
+ * Copy the part of @param entry that is newer than the area's tail into the data ring
+ */
+static void aesd_mmap_copy_entry(struct aesd_mmap_area *area, const struct aesd_buffer_entry *entry)
+{
+    uint64_t tail = area->hdr->tail;
+    size_t skip = 0;
+
+    if (entry->offset + entry->size <= tail)
+        return;
+    if (entry->offset < tail)
+        skip = tail - entry->offset;
+    aesd_mmap_copy(area, entry->offset + skip, entry->buffptr + skip, entry->size - skip);
+}
+
+static uint64_t aesd_mmap_tail(const struct aesd_circular_buffer *buffer, uint64_t data_size)
+{
+    if (buffer->end_offset - buffer->start_offset > data_size)
+        return buffer->end_offset - data_size;
+    return buffer->start_offset;
+}
+
+/**
+ * Allocate an area sized for @param buffer's capacity with a @param data_size byte data ring
+ * (a power of two, at least PAGE_SIZE) and fill it with the current entries.
+ * Caller holds dev->lock.
+ */
+struct aesd_mmap_area *aesd_mmap_area_create(const struct aesd_circular_buffer *buffer, size_t data_size)
+{
+    struct aesd_mmap_area *area;
+    struct aesd_mmap_header *hdr;
+    size_t entries_offset = ALIGN(sizeof(*hdr), 64);
+    size_t data_offset = PAGE_ALIGN(entries_offset +
+                                    (size_t)buffer->capacity * sizeof(struct aesd_mmap_entry));
+    uint32_t count = aesd_circular_buffer_count(buffer);
+    const struct aesd_buffer_entry *entry;
+    uint32_t i, slot;
+
+    area = kzalloc(sizeof(*area), GFP_KERNEL);
+    if (!area)
+        return NULL;
+
+    area->size = data_offset + data_size;
+    hdr = vmalloc_user(area->size);
+    if (!hdr) {
+        kfree(area);
+        return NULL;
+    }
+    kref_init(&area->ref);
+    area->hdr = hdr;
+    area->entries = (struct aesd_mmap_entry *)((char *)hdr + entries_offset);
+    area->data = (char *)hdr + data_offset;
+
+    hdr->magic = AESD_MMAP_MAGIC;
+    hdr->version = AESD_MMAP_VERSION;
+    hdr->area_size = area->size;
+    hdr->entries_offset = entries_offset;
+    hdr->entry_capacity = buffer->capacity;
+    hdr->first_entry = buffer->out_offs;
+    hdr->entry_count = count;
+    hdr->data_offset = data_offset;
+    hdr->data_size = data_size;
+    hdr->start = buffer->start_offset;
+    hdr->head = buffer->end_offset;
+    hdr->tail = aesd_mmap_tail(buffer, data_size);
+
+    AESD_CIRCULAR_BUFFER_FOREACH_LIVE(entry, buffer, i) {
+        /* The entry table mirrors the slot layout, see first_entry */
+        slot = entry - buffer->entry;
+        area->entries[slot].offset = entry->offset;
+        area->entries[slot].size = entry->size;
+        aesd_mmap_copy_entry(area, entry);
+    }
+    return area;
+}
+
+/**
+ * Publish the entry most recently added to @param buffer.  Caller holds dev->lock.
+ */
+void aesd_mmap_area_sync_add(struct aesd_mmap_area *area, const struct aesd_circular_buffer *buffer)
+{
+    struct aesd_mmap_header *hdr = area->hdr;
+    uint32_t newest = aesd_circular_buffer_wrap(buffer, buffer->in_offs + buffer->capacity - 1);
+    const struct aesd_buffer_entry *entry = &buffer->entry[newest];
+
+    aesd_mmap_write_begin(hdr);
+    /* Move tail past the bytes about to be overwritten before overwriting them */
+    WRITE_ONCE(hdr->tail, aesd_mmap_tail(buffer, hdr->data_size));
+    smp_wmb();
+    aesd_mmap_copy_entry(area, entry);
+    area->entries[newest].offset = entry->offset;
+    area->entries[newest].size = entry->size;
+    WRITE_ONCE(hdr->first_entry, buffer->out_offs);
+    WRITE_ONCE(hdr->entry_count, aesd_circular_buffer_count(buffer));
+    WRITE_ONCE(hdr->start, buffer->start_offset);
+    smp_wmb();
+    WRITE_ONCE(hdr->head, buffer->end_offset);
+    aesd_mmap_write_end(hdr);
+}
+
+/**
+ * Tell mappers of @param area that it was replaced; it is not updated afterwards
+ */
+void aesd_mmap_area_mark_stale(struct aesd_mmap_area *area)
+{
+    aesd_mmap_write_begin(area->hdr);
+    WRITE_ONCE(area->hdr->flags, area->hdr->flags | AESD_MMAP_STALE);
+    aesd_mmap_write_end(area->hdr);
+}
+
+static void aesd_mmap_area_free_rcu(struct rcu_head *head)
+{
+    struct aesd_mmap_area *area = container_of(head, struct aesd_mmap_area, rcu);
+
+    vfree(area->hdr);
+    kfree(area);
+}
+
+static void aesd_mmap_area_release(struct kref *ref)
+{
+    struct aesd_mmap_area *area = container_of(ref, struct aesd_mmap_area, ref);
+
+    /* aesd_mmap() may still be looking at the area under rcu_read_lock() */
+    call_rcu(&area->rcu, aesd_mmap_area_free_rcu);
+}
+
+void aesd_mmap_area_put(struct aesd_mmap_area *area)
+{
+    kref_put(&area->ref, aesd_mmap_area_release);
+}
+
+static void aesd_mmap_vm_open(struct vm_area_struct *vma)
+{
+    struct aesd_mmap_area *area = vma->vm_private_data;
+
+    kref_get(&area->ref);
+}
+
+static void aesd_mmap_vm_close(struct vm_area_struct *vma)
+{
+    aesd_mmap_area_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct aesd_mmap_vm_ops = {
+    .open =  aesd_mmap_vm_open,
+    .close = aesd_mmap_vm_close,
+};
+
+/**
+ * Map @param area read-only into @param vma.  Consumes the caller's reference on success.
+ */
+int aesd_mmap_area_map(struct aesd_mmap_area *area, struct vm_area_struct *vma)
+{
+    int err;
+
+    if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > area->size)
+        return -EINVAL;
+    if (vma->vm_flags & VM_WRITE)
+        return -EPERM;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    err = remap_vmalloc_range(vma, area->hdr, 0);
+    if (err)
+        return err;
+
+    vma->vm_private_data = area;
+    vma->vm_ops = &aesd_mmap_vm_ops;
+    return 0;
+}
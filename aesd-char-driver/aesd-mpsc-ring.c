@@ -0,0 +1,120 @@
+/**
+ * @file aesd-mpsc-ring.c
+ * @brief Bounded lock-free multi-producer single-consumer ring, see aesd-mpsc-ring.h
+ *
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+
+#include "aesd-mpsc-ring.h"
+
+/**
+* Initializes @param ring to an empty ring of at least @param capacity slots, rounded up to a
+* power of two.
+* @return 0, or -1 with errno set
+*/
+int aesd_mpsc_ring_init(struct aesd_mpsc_ring *ring, size_t capacity)
+{
+    size_t slots = 2;
+    size_t i;
+
+    while (slots < capacity)
+    {
+        slots <<= 1;
+        if (slots == 0)
+        {
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    ring->slot = aligned_alloc(AESD_CACHE_LINE, slots * sizeof(*ring->slot));
+    if (!ring->slot)
+    {
+        return -1;
+    }
+    for (i = 0; i < slots; i++)
+    {
+        atomic_init(&ring->slot[i].seq, i);
+        ring->slot[i].item = NULL;
+    }
+    ring->mask = slots - 1;
+    ring->head = 0;
+    atomic_init(&ring->tail, 0);
+    return 0;
+}
+
+/**
+* Frees the slots of @param ring.  Items still queued are not touched.
+*/
+void aesd_mpsc_ring_destroy(struct aesd_mpsc_ring *ring)
+{
+    free(ring->slot);
+    ring->slot = NULL;
+}
+
+/**
+* Adds @param item to @param ring.  Safe to call from any number of threads at once.
+* @return false if the ring was full
+*/
+bool aesd_mpsc_ring_push(struct aesd_mpsc_ring *ring, void *item)
+{
+    struct aesd_mpsc_slot *slot;
+    size_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t seq;
+
+    for (;;)
+    {
+        slot = &ring->slot[pos & ring->mask];
+        seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq == pos)
+        {
+            // The slot is free for this lap; claim it unless another producer got there first
+            if (atomic_compare_exchange_weak_explicit(&ring->tail, &pos, pos + 1,
+                        memory_order_relaxed, memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        else if ((intptr_t)(seq - pos) < 0)
+        {
+            // Still holding the previous lap's item: full
+            return false;
+        }
+        else
+        {
+            pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+        }
+    }
+
+    slot->item = item;
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+/**
+* Takes up to @param max items from @param ring, oldest first, into @param items.
+* Consumer only.  Stops early at a slot a producer has claimed but not yet filled.
+* @return the number of items taken
+*/
+size_t aesd_mpsc_ring_pop_batch(struct aesd_mpsc_ring *ring, void **items, size_t max)
+{
+    size_t pos = ring->head;
+    size_t n = 0;
+    struct aesd_mpsc_slot *slot;
+
+    while (n < max)
+    {
+        slot = &ring->slot[pos & ring->mask];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        {
+            break;
+        }
+        items[n++] = slot->item;
+        atomic_store_explicit(&slot->seq, pos + ring->mask + 1, memory_order_release);
+        pos++;
+    }
+    ring->head = pos;
+    return n;
+}
@@ -0,0 +1,77 @@
+/*
+ * aesd-mpsc-ring.h
+ *
+ *  @brief Bounded lock-free ring of pointers with many producers and a single consumer,
+ *  for user space (C11 atomics)
+ *
+ * Each slot carries a sequence number telling whose turn it is: a producer claims position p
+ * with a compare-and-swap on tail once slot p's sequence is p, fills it and publishes p + 1;
+ * the consumer takes it when it sees p + 1 and hands the slot back to the producers of the
+ * next lap by storing p + capacity.  tail and head live on cache lines of their own so
+ * producers and the consumer do not bounce each other's line.
+ */
+
+#ifndef AESD_MPSC_RING_H
+#define AESD_MPSC_RING_H
+
+#ifdef __KERNEL__
+#error "aesd-mpsc-ring is user space only"
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define AESD_CACHE_LINE 64
+
+struct aesd_mpsc_slot
+{
+    /**
+     * Position the slot is waiting for: its enqueue position while free, one past that once
+     * filled, and the enqueue position of the next lap once consumed
+     */
+    atomic_size_t seq;
+    void *item;
+};
+
+struct aesd_mpsc_ring
+{
+    /**
+     * Next position a producer claims
+     */
+    _Alignas(AESD_CACHE_LINE) atomic_size_t tail;
+    /**
+     * Next position the consumer takes.  Only the consumer touches it
+     */
+    _Alignas(AESD_CACHE_LINE) size_t head;
+    /**
+     * Read-only after init, kept off the lines above
+     */
+    _Alignas(AESD_CACHE_LINE) struct aesd_mpsc_slot *slot;
+    /**
+     * Slot count - 1, the count being a power of two
+     */
+    size_t mask;
+};
+
+/**
+ * @return true when the consumer has nothing to take.  Consumer only; a producer that has
+ * claimed a slot but not yet filled it counts as nothing
+ */
+static inline bool aesd_mpsc_ring_empty(struct aesd_mpsc_ring *ring)
+{
+    struct aesd_mpsc_slot *slot = &ring->slot[ring->head & ring->mask];
+
+    return atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->head + 1;
+}
+
+extern int aesd_mpsc_ring_init(struct aesd_mpsc_ring *ring, size_t capacity);
+
+extern void aesd_mpsc_ring_destroy(struct aesd_mpsc_ring *ring);
+
+extern bool aesd_mpsc_ring_push(struct aesd_mpsc_ring *ring, void *item);
+
+extern size_t aesd_mpsc_ring_pop_batch(struct aesd_mpsc_ring *ring, void **items, size_t max);
+
+#endif /* AESD_MPSC_RING_H */
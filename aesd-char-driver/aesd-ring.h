@@ -0,0 +1,154 @@
+/*
+ * aesd-ring.h
+ *
+ *  @brief Typed ring buffers generated at compile time, and the index helpers shared with
+ *  aesd_circular_buffer
+ *
+ * AESD_RING_DEFINE(name, type, capacity) declares struct name, holding up to capacity elements
+ * of type inline, and static inline functions over it:
+ *
+ *   name_init(ring)          empty the ring
+ *   name_count(ring)         number of live elements
+ *   name_full(ring)          whether a push will overwrite the oldest element
+ *   name_nth(ring, n)        the n-th oldest live element, n < count
+ *   name_oldest(ring)        the oldest live element, NULL if empty
+ *   name_newest(ring)        the newest live element, NULL if empty
+ *   name_push_slot(ring)     the slot for a new newest element, overwriting the oldest when full
+ *   name_push(ring, elem)    copy *elem in as the newest element, overwriting the oldest when full
+ *   name_pop(ring)           drop the oldest element and return it, valid until the next push,
+ *                            or NULL if empty
+ *
+ * and AESD_RING_FOREACH(name, ring, index, elem) visits the live elements, oldest first.
+ *
+ * capacity must be a compile time constant, so index wrapping compiles to a mask when it is a
+ * power of two and to a compare and subtract otherwise, without a division or a branch on a
+ * runtime mask.  The ring keeps the oldest slot and the live count next to each other ahead of
+ * the elements, which are stored contiguously, so a walk from the oldest element reads memory
+ * in order and wraps at most once.
+ *
+ * Rings sized at run time, like aesd_circular_buffer, use aesd_ring_mask() and aesd_ring_wrap()
+ * instead.
+ */
+
+#ifndef AESD_RING_H
+#define AESD_RING_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#endif
+
+/**
+ * @return the mask for a ring of @param capacity slots: capacity - 1 for a power of two, else 0
+ */
+static inline uint32_t aesd_ring_mask(uint32_t capacity)
+{
+    return (capacity & (capacity - 1)) == 0 ? capacity - 1 : 0;
+}
+
+/**
+ * @return the slot index for @param offs, a slot index plus at most @param capacity, in a ring
+ * whose aesd_ring_mask() is @param mask
+ */
+static inline uint32_t aesd_ring_wrap(uint32_t offs, uint32_t capacity, uint32_t mask)
+{
+    if (mask)
+        return offs & mask;
+    return offs >= capacity ? offs - capacity : offs;
+}
+
+/**
+ * aesd_ring_wrap() for a constant @param capacity, which folds to one of its two forms
+ */
+#define AESD_RING_WRAP_CONST(offs, capacity) \
+    (((capacity) & ((capacity) - 1)) == 0 ? (offs) & ((capacity) - 1) : \
+     (offs) >= (capacity) ? (offs) - (capacity) : (offs))
+
+#define AESD_RING_DEFINE(name, type, capacity)                                              \
+_Static_assert((capacity) > 0 && (capacity) <= 0x80000000u, #name ": bad ring capacity");    \
+                                                                                            \
+struct name                                                                                 \
+{                                                                                           \
+    uint32_t head;                      /* Slot of the oldest element */                    \
+    uint32_t count;                     /* Live elements */                                 \
+    type slot[capacity];                                                                    \
+};                                                                                          \
+                                                                                            \
+static inline uint32_t name##_wrap(uint32_t offs)                                           \
+{                                                                                           \
+    return AESD_RING_WRAP_CONST(offs, (uint32_t)(capacity));                                \
+}                                                                                           \
+                                                                                            \
+static inline void name##_init(struct name *ring)                                           \
+{                                                                                           \
+    ring->head = 0;                                                                         \
+    ring->count = 0;                                                                        \
+}                                                                                           \
+                                                                                            \
+static inline uint32_t name##_count(const struct name *ring)                                \
+{                                                                                           \
+    return ring->count;                                                                     \
+}                                                                                           \
+                                                                                            \
+static inline bool name##_full(const struct name *ring)                                     \
+{                                                                                           \
+    return ring->count == (capacity);                                                       \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_nth(struct name *ring, uint32_t n)                               \
+{                                                                                           \
+    return &ring->slot[name##_wrap(ring->head + n)];                                        \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_oldest(struct name *ring)                                        \
+{                                                                                           \
+    return ring->count ? &ring->slot[ring->head] : NULL;                                    \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_newest(struct name *ring)                                        \
+{                                                                                           \
+    return ring->count ? name##_nth(ring, ring->count - 1) : NULL;                          \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_push_slot(struct name *ring)                                     \
+{                                                                                           \
+    if (ring->count == (capacity)) {                                                        \
+        type *slot = &ring->slot[ring->head];                                               \
+        ring->head = name##_wrap(ring->head + 1);                                           \
+        return slot;                                                                        \
+    }                                                                                       \
+    return name##_nth(ring, ring->count++);                                                 \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_push(struct name *ring, const type *elem)                        \
+{                                                                                           \
+    type *slot = name##_push_slot(ring);                                                    \
+    *slot = *elem;                                                                          \
+    return slot;                                                                            \
+}                                                                                           \
+                                                                                            \
+static inline type *name##_pop(struct name *ring)                                           \
+{                                                                                           \
+    type *slot;                                                                             \
+                                                                                            \
+    if (!ring->count)                                                                       \
+        return NULL;                                                                        \
+    slot = &ring->slot[ring->head];                                                         \
+    ring->head = name##_wrap(ring->head + 1);                                               \
+    ring->count--;                                                                          \
+    return slot;                                                                            \
+}
+
+/**
+ * Iterate over the live elements of @param ring, a struct @param name *, oldest first.
+ * @param index is a uint32_t counting from 0 and @param elem the type * set to each element.
+ * The ring must not change during the loop.
+ */
+#define AESD_RING_FOREACH(name, ring, index, elem) \
+    for ((index) = 0; (index) < name##_count(ring) && (((elem) = name##_nth((ring), (index))), true); \
+         (index)++)
+
+#endif /* AESD_RING_H */
@@ -0,0 +1,104 @@
+/**
+ * @file aesd-stats.c
+ * @brief Per-CPU event counters of the aesdchar device, exported through debugfs
+ *
+ * Counters are bumped with this_cpu operations on the hot paths and only summed
+ * when <debugfs>/aesdchar/aesdchar<N>/stats or .../latency is read.  stats also
+ * reports the entries and bytes currently retained and the device's NUMA node.
+ */
+
+#include <linux/kernel.h>
+#include <linux/percpu.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include "aesdchar.h"
+
+/**
+ * Add up the counters of every CPU into @param sum
+ */
+static void aesd_stats_sum(struct aesd_dev *dev, struct aesd_stats *sum)
+{
+    const u64 *src;
+    u64 *dst = (u64 *)sum;
+    size_t i;
+    int cpu;
+
+    memset(sum, 0, sizeof(*sum));
+    for_each_possible_cpu(cpu) {
+        /* Every field is a u64 */
+        src = (const u64 *)per_cpu_ptr(dev->stats, cpu);
+        for (i = 0; i < sizeof(*sum) / sizeof(u64); i++)
+            dst[i] += READ_ONCE(src[i]);
+    }
+}
+
+static int aesd_stats_show(struct seq_file *m, void *v)
+{
+    struct aesd_dev *dev = m->private;
+    struct aesd_stats sum;
+    uint32_t entries;
+    size_t retained;
+
+    mutex_lock(&dev->lock);
+    entries = aesd_circular_buffer_count(&dev->buffer);
+    retained = aesd_circular_buffer_size(&dev->buffer);
+    mutex_unlock(&dev->lock);
+
+    aesd_stats_sum(dev, &sum);
+    seq_printf(m, "node %d\n", dev->node);
+    seq_printf(m, "entries %u\n", entries);
+    seq_printf(m, "retained_bytes %zu\n", retained);
+    seq_printf(m, "writes %llu\n", sum.writes);
+    seq_printf(m, "write_bytes %llu\n", sum.write_bytes);
+    seq_printf(m, "partial_writes %llu\n", sum.partial_writes);
+    seq_printf(m, "reads %llu\n", sum.reads);
+    seq_printf(m, "read_bytes %llu\n", sum.read_bytes);
+    seq_printf(m, "evictions %llu\n", sum.evictions);
+    seq_printf(m, "seeks %llu\n", sum.seeks);
+    seq_printf(m, "lock_contended %llu\n", sum.lock_contended);
+    seq_printf(m, "lock_wait_ns %llu\n", sum.lock_wait_ns);
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_stats);
+
+/**
+ * One line per nonempty bucket: its lower bound in ns and the reads and writes that took
+ * at least that long but less than twice that
+ */
+static int aesd_latency_show(struct seq_file *m, void *v)
+{
+    struct aesd_stats sum;
+    int i;
+
+    aesd_stats_sum(m->private, &sum);
+    seq_printf(m, "%-12s %12s %12s\n", "ns", "reads", "writes");
+    for (i = 0; i < AESD_LAT_BUCKETS; i++) {
+        if (sum.read_lat[i] || sum.write_lat[i])
+            seq_printf(m, "%-12llu %12llu %12llu\n", 1ULL << i, sum.read_lat[i], sum.write_lat[i]);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(aesd_latency);
+
+/**
+ * Allocate @param dev's counters and create their debugfs files in directory @param name
+ * under @param parent.
+ * Missing debugfs support only loses the files.
+ */
+int aesd_stats_init(struct aesd_dev *dev, struct dentry *parent, const char *name)
+{
+    dev->stats = alloc_percpu(struct aesd_stats);
+    if (!dev->stats)
+        return -ENOMEM;
+
+    dev->debugfs = debugfs_create_dir(name, parent);
+    debugfs_create_file("stats", 0444, dev->debugfs, dev, &aesd_stats_fops);
+    debugfs_create_file("latency", 0444, dev->debugfs, dev, &aesd_latency_fops);
+    return 0;
+}
+
+void aesd_stats_exit(struct aesd_dev *dev)
+{
+    debugfs_remove_recursive(dev->debugfs);
+    free_percpu(dev->stats);
+}
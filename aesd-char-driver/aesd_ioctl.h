@@ -33,14 +33,165 @@ struct aesd_seekto {
     uint32_t write_cmd_offset;
 };
 
+/**
+ * One write command, as reported by AESDCHAR_IOCENTRIES and AESDCHAR_IOCREADENTRIES
+ */
+struct aesd_entry_info {
+    /**
+     * Sequence number of the write command, counting every command written to the device
+     */
+    uint64_t seq;
+    /**
+     * Stream offset of its first byte; its file position is offset minus the stream offset
+     * of file position 0
+     */
+    uint64_t offset;
+    /**
+     * Number of bytes, including the newline
+     */
+    uint64_t size;
+    /**
+     * Commit time in ns since the epoch (CLOCK_REALTIME)
+     */
+    uint64_t timestamp_ns;
+};
+
+/**
+ * Argument of AESDCHAR_IOCENTRIES
+ */
+struct aesd_entry_table {
+    /**
+     * In: sequence number of the first entry wanted.  Entries already dropped are skipped,
+     * so 0 starts at the oldest entry.  Out: sequence number of the first entry reported
+     */
+    uint64_t first_seq;
+    /**
+     * In: user pointer to an array of count struct aesd_entry_info
+     */
+    uint64_t entries;
+    /**
+     * In: length of the entries array.  Out: number of entries filled in
+     */
+    uint32_t count;
+    uint32_t reserved;
+    /**
+     * Out: stream offset of file position 0 when the call started
+     */
+    uint64_t start;
+    /**
+     * Out: sequence number the next write command gets, as of when the call started
+     */
+    uint64_t next_seq;
+};
+
+/**
+ * Argument of AESDCHAR_IOCREADENTRIES
+ */
+struct aesd_entry_read {
+    /**
+     * In: sequence number of the first entry wanted.  Out: sequence number of the first entry
+     * read.  As for struct aesd_entry_table
+     */
+    uint64_t first_seq;
+    /**
+     * In: user pointer to the buffer receiving the entries, back to back
+     */
+    uint64_t buf;
+    /**
+     * In: size of buf.  Out: number of bytes stored, or the size of the first entry if it
+     * does not fit (the ioctl then fails with EMSGSIZE)
+     */
+    uint64_t bytes;
+    /**
+     * In: user pointer to an array of count struct aesd_entry_info describing the entries read,
+     * or 0
+     */
+    uint64_t entries;
+    /**
+     * In: most entries to read, at most AESDCHAR_MAX_READ_ENTRIES.  Out: number of entries read
+     */
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/**
+ * Argument of AESDCHAR_IOCSEEKSEQ
+ */
+struct aesd_seekseq {
+    /**
+     * In: sequence number to seek to.  Out: sequence number of the entry the file position
+     * now points at, which is the next sequence number if there was no such entry
+     */
+    uint64_t seq;
+};
+
+/**
+ * Filled in by AESDCHAR_IOCSEQRANGE
+ */
+struct aesd_seq_range {
+    /**
+     * Sequence number of the oldest entry retained
+     */
+    uint64_t first_seq;
+    /**
+     * Sequence number the next write command gets; first_seq when the device is empty
+     */
+    uint64_t next_seq;
+    /**
+     * Stream offsets of the oldest byte retained, file position 0, and one past the newest byte
+     */
+    uint64_t start;
+    uint64_t end;
+};
+
+/**
+ * Largest count accepted by AESDCHAR_IOCREADENTRIES
+ */
+#define AESDCHAR_MAX_READ_ENTRIES 1024
+
 // Pick an arbitrary unused value from https://github.com/torvalds/linux/blob/master/Documentation/userspace-api/ioctl/ioctl-number.rst
 #define AESD_IOC_MAGIC 0x16
 
 // Define a write command from the user point of view, use command number 1
 #define AESDCHAR_IOCSEEKTO _IOWR(AESD_IOC_MAGIC, 1, struct aesd_seekto)
+/**
+ * Change the number of write commands the device retains.  Existing entries are kept,
+ * except that shrinking below the current count drops the oldest ones.
+ * Power of two capacities are fastest.
+ */
+#define AESDCHAR_IOCRESIZE _IOW(AESD_IOC_MAGIC, 2, uint32_t)
+/**
+ * Largest capacity accepted by AESDCHAR_IOCRESIZE and the ring_entries module parameter
+ */
+#define AESDCHAR_MAX_RING_ENTRIES (1U << 24)
+/**
+ * Nonzero puts this open file in follow mode: reads at the end of the data wait for the next
+ * write command (or fail with EAGAIN under O_NONBLOCK) instead of returning 0, and the read
+ * position sticks to the data as old entries are dropped.  Zero restores normal reads.
+ */
+#define AESDCHAR_IOCFOLLOW _IOW(AESD_IOC_MAGIC, 3, uint32_t)
+/**
+ * Report the entries from first_seq on: sequence number, stream offset and size of each
+ */
+#define AESDCHAR_IOCENTRIES _IOWR(AESD_IOC_MAGIC, 4, struct aesd_entry_table)
+/**
+ * Copy whole entries from first_seq on into buf, as many as fit and count allows.  The entries
+ * read are a consistent snapshot: consecutive, and all present on the device at one time.
+ */
+#define AESDCHAR_IOCREADENTRIES _IOWR(AESD_IOC_MAGIC, 5, struct aesd_entry_read)
+/**
+ * Set the file position to the start of the first entry whose sequence number is at least seq,
+ * or to the end of the data if there is none.  Unlike AESDCHAR_IOCSEEKTO, the target does not
+ * shift as old entries are dropped, so a consumer can resume from the last seq it saw plus one.
+ */
+#define AESDCHAR_IOCSEEKSEQ _IOWR(AESD_IOC_MAGIC, 6, struct aesd_seekseq)
+/**
+ * Report the range of sequence numbers and stream offsets retained
+ */
+#define AESDCHAR_IOCSEQRANGE _IOR(AESD_IOC_MAGIC, 7, struct aesd_seq_range)
 /**
  * The maximum number of commands supported, used for bounds checking
  */
-#define AESDCHAR_IOC_MAXNR 1
+#define AESDCHAR_IOC_MAXNR 7
 
 #endif /* AESD_IOCTL_H */
@@ -0,0 +1,93 @@
+/*
+ * aesd_mmap.h
+ *
+ *  @brief Layout of the read-only history mapping of aesd char devices, shared
+ *  between the driver and user space
+ *
+ * mmap() of /dev/aesdchar (offset 0, PROT_READ, MAP_SHARED) maps, in order, a
+ * struct aesd_mmap_header, the entry table at entries_offset and the data ring at
+ * data_offset.  Every byte written to the device has a stream offset; the byte at
+ * stream offset X is stored at data[X & (data_size - 1)] and is present while
+ * tail <= X < head.  File position 0 corresponds to stream offset start.
+ *
+ * The driver bumps seq to an odd value before it changes the area and to an even
+ * value once done.  To read consistently, load seq (retry while odd), read, then
+ * check seq is unchanged.  Readers copying data may instead check that tail has not
+ * passed the copied range after copying: the driver advances tail before it
+ * overwrites data and advances head only after the new data is in place.
+ *
+ * When the device ring is resized the mapping is replaced: the old area gets
+ * AESD_MMAP_STALE in flags and no longer changes, and must be mapped again.
+ */
+
+#ifndef AESD_MMAP_H
+#define AESD_MMAP_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#else
+#include <stdint.h>
+#endif
+
+#define AESD_MMAP_MAGIC   0x44534541u   /* "AESD" */
+#define AESD_MMAP_VERSION 1
+
+/**
+ * Set in aesd_mmap_header.flags once the area has been replaced
+ */
+#define AESD_MMAP_STALE   0x1u
+
+struct aesd_mmap_header {
+    uint32_t magic;
+    uint32_t version;
+    /**
+     * Odd while the driver is updating the area
+     */
+    uint32_t seq;
+    uint32_t flags;
+    /**
+     * Size of the whole area in bytes
+     */
+    uint64_t area_size;
+    /**
+     * Entry table location and size, one struct aesd_mmap_entry per ring slot
+     */
+    uint64_t entries_offset;
+    uint32_t entry_capacity;
+    /**
+     * Table index of the oldest entry and number of entries, following entries wrap
+     */
+    uint32_t first_entry;
+    uint32_t entry_count;
+    uint32_t reserved;
+    /**
+     * Data ring location and size, size is a power of two
+     */
+    uint64_t data_offset;
+    uint64_t data_size;
+    /**
+     * Stream offset one past the newest byte
+     */
+    uint64_t head;
+    /**
+     * Oldest stream offset still held in the data ring
+     */
+    uint64_t tail;
+    /**
+     * Stream offset of the oldest byte retained by the device, file position 0
+     */
+    uint64_t start;
+};
+
+struct aesd_mmap_entry {
+    /**
+     * Stream offset of the first byte of the entry
+     */
+    uint64_t offset;
+    /**
+     * Number of bytes in the entry
+     */
+    uint64_t size;
+};
+
+#endif /* AESD_MMAP_H */
@@ -0,0 +1,124 @@
+/*
+ * aesd_trace.h
+ *
+ *  @brief Tracepoints of the aesdchar driver, under events/aesdchar/ in tracefs
+ *
+ * Stream offsets count every byte ever written to the device and sequence numbers
+ * every write command, see aesd_ioctl.h.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM aesdchar
+
+#if !defined(AESD_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define AESD_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/kdev_t.h>
+
+/*
+ * A write command became an entry.  lock_wait_ns is the time its writer waited for
+ * dev->lock, shared by all commands committed under that acquisition.
+ */
+TRACE_EVENT(aesd_commit,
+    TP_PROTO(dev_t devt, u64 seq, u64 offset, u64 size, u64 lock_wait_ns),
+    TP_ARGS(devt, seq, offset, size, lock_wait_ns),
+    TP_STRUCT__entry(
+        __field(dev_t, devt)
+        __field(u64, seq)
+        __field(u64, offset)
+        __field(u64, size)
+        __field(u64, lock_wait_ns)
+    ),
+    TP_fast_assign(
+        __entry->devt = devt;
+        __entry->seq = seq;
+        __entry->offset = offset;
+        __entry->size = size;
+        __entry->lock_wait_ns = lock_wait_ns;
+    ),
+    TP_printk("dev=%d:%d seq=%llu offset=%llu size=%llu lock_wait_ns=%llu",
+              MAJOR(__entry->devt), MINOR(__entry->devt), __entry->seq,
+              __entry->offset, __entry->size, __entry->lock_wait_ns)
+);
+
+/*
+ * An entry was dropped to make room, or by a resize
+ */
+TRACE_EVENT(aesd_evict,
+    TP_PROTO(dev_t devt, u64 seq, u64 offset, u64 size),
+    TP_ARGS(devt, seq, offset, size),
+    TP_STRUCT__entry(
+        __field(dev_t, devt)
+        __field(u64, seq)
+        __field(u64, offset)
+        __field(u64, size)
+    ),
+    TP_fast_assign(
+        __entry->devt = devt;
+        __entry->seq = seq;
+        __entry->offset = offset;
+        __entry->size = size;
+    ),
+    TP_printk("dev=%d:%d seq=%llu offset=%llu size=%llu",
+              MAJOR(__entry->devt), MINOR(__entry->devt), __entry->seq,
+              __entry->offset, __entry->size)
+);
+
+/*
+ * A read copied size bytes from stream offset offset, in entry seq onwards, taking latency_ns
+ */
+TRACE_EVENT(aesd_read,
+    TP_PROTO(dev_t devt, u64 seq, u64 offset, u64 size, u64 latency_ns),
+    TP_ARGS(devt, seq, offset, size, latency_ns),
+    TP_STRUCT__entry(
+        __field(dev_t, devt)
+        __field(u64, seq)
+        __field(u64, offset)
+        __field(u64, size)
+        __field(u64, latency_ns)
+    ),
+    TP_fast_assign(
+        __entry->devt = devt;
+        __entry->seq = seq;
+        __entry->offset = offset;
+        __entry->size = size;
+        __entry->latency_ns = latency_ns;
+    ),
+    TP_printk("dev=%d:%d seq=%llu offset=%llu size=%llu latency_ns=%llu",
+              MAJOR(__entry->devt), MINOR(__entry->devt), __entry->seq,
+              __entry->offset, __entry->size, __entry->latency_ns)
+);
+
+/*
+ * The file position moved to pos, stream offset offset, in entry seq, by llseek,
+ * AESDCHAR_IOCSEEKTO or AESDCHAR_IOCSEEKSEQ.  seq is the next entry's when pos is at the end.
+ */
+TRACE_EVENT(aesd_seek,
+    TP_PROTO(dev_t devt, u64 seq, s64 pos, u64 offset),
+    TP_ARGS(devt, seq, pos, offset),
+    TP_STRUCT__entry(
+        __field(dev_t, devt)
+        __field(u64, seq)
+        __field(s64, pos)
+        __field(u64, offset)
+    ),
+    TP_fast_assign(
+        __entry->devt = devt;
+        __entry->seq = seq;
+        __entry->pos = pos;
+        __entry->offset = offset;
+    ),
+    TP_printk("dev=%d:%d seq=%llu pos=%lld offset=%llu",
+              MAJOR(__entry->devt), MINOR(__entry->devt), __entry->seq,
+              __entry->pos, __entry->offset)
+);
+
+#endif /* AESD_TRACE_H */
+
+/* Out of tree: the Makefile adds the driver directory to the include path */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE aesd_trace
+#include <trace/define_trace.h>
@@ -9,31 +9,126 @@
 #define AESD_CHAR_DRIVER_AESDCHAR_H_
 
 #include <linux/mutex.h>
+#include <linux/seqlock.h>
+#include <linux/srcu.h>
+#include <linux/kref.h>
+#include <linux/wait.h>
+#include <linux/percpu.h>
+#include <linux/log2.h>
+#include <linux/ktime.h>
 #include "aesd-circular-buffer.h"
+#include "aesd_mmap.h"
 
-#define AESD_DEBUG 1  //Remove comment on this line to enable debug
+//#define AESD_DEBUG 1  //Remove comment on this line to enable debug in user space
 
 #undef PDEBUG             /* undef it, just in case */
-#ifdef AESD_DEBUG
-#  ifdef __KERNEL__
-     /* This one if debugging is on, and kernel space */
-#    define PDEBUG(fmt, args...) printk( KERN_DEBUG "aesdchar: " fmt, ## args)
-#  else
+#ifdef __KERNEL__
+     /* Kernel space: pr_debug(), enabled at runtime through dynamic debug */
+#  define PDEBUG(fmt, args...) pr_debug("aesdchar: " fmt "\n", ## args)
+#elif defined(AESD_DEBUG)
      /* This one for user space */
-#    define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
-#  endif
+#  define PDEBUG(fmt, args...) fprintf(stderr, fmt, ## args)
 #else
 #  define PDEBUG(fmt, args...) /* not debugging: nothing */
 #endif
 
+/*
+ * The area mapped by mmap(), see aesd_mmap.h.  Mappings hold a reference each.
+ */
+struct aesd_mmap_area
+{
+    struct kref ref;
+    struct rcu_head rcu;
+    struct aesd_mmap_header *hdr;           /* vmalloc_user() area, header first */
+    struct aesd_mmap_entry *entries;
+    char *data;
+    size_t size;
+};
+
+#define AESD_LAT_BUCKETS 32
+
+/*
+ * Event counters, one copy per CPU.  Latency bucket i counts calls that took [2^i, 2^(i+1)) ns,
+ * the last bucket also everything longer.
+ */
+struct aesd_stats
+{
+    u64 writes;
+    u64 write_bytes;
+    u64 partial_writes;                     /* Writes leaving a partial line staged */
+    u64 reads;
+    u64 read_bytes;
+    u64 evictions;                          /* Entries dropped to make room */
+    u64 seeks;
+    u64 lock_contended;                     /* Times dev->lock was not free */
+    u64 lock_wait_ns;
+    u64 read_lat[AESD_LAT_BUCKETS];
+    u64 write_lat[AESD_LAT_BUCKETS];
+};
+
+#define aesd_stat_inc(dev, field)    this_cpu_inc((dev)->stats->field)
+#define aesd_stat_add(dev, field, n) this_cpu_add((dev)->stats->field, n)
+
+/**
+ * Count a call that started at @param start_ns in latency histogram @param field
+ */
+#define aesd_stat_latency(dev, field, start_ns) \
+    this_cpu_inc((dev)->stats->field[min_t(u64, ilog2((ktime_get_ns() - (start_ns)) | 1), \
+                                           AESD_LAT_BUCKETS - 1)])
+
+/*
+ * Entry bytes live back to back in the data byte ring, oldest entry first; adding an entry
+ * drops the oldest entries to make room.
+ * Readers take no lock: they snapshot the ring under seq inside an srcu read section, which
+ * keeps a replaced entry table alive, and check start_offset after copying in case the bytes
+ * were reused.  lock serializes writers, and every change to buffer is made inside a seq
+ * write section.
+ */
 struct aesd_dev
 {
-    struct mutex lock;                      /* Mutex for synchronization */
+    struct mutex lock;                      /* Serializes writers */
+    seqcount_mutex_t seq;                   /* Bumped around every update of buffer */
+    struct srcu_struct srcu;                /* Defers freeing of replaced entry tables */
     struct aesd_circular_buffer buffer;     /* Circular buffer for storing writes */
-    char *working_entry;                    /* Buffer for accumulating partial write */
-    size_t working_entry_size;              /* Current size of working entry */
+    struct aesd_mmap_area __rcu *mmap_area; /* Current mappable copy of buffer, NULL if disabled */
+    wait_queue_head_t readq;                /* Woken when an entry is added */
+    struct aesd_stats __percpu *stats;
+    struct dentry *debugfs;
+    char *data;                             /* Byte ring holding entry data */
+    size_t data_size;
+    size_t data_head;                       /* Ring offset where the next entry starts */
+    char *carry;                            /* Partial line left by a closed file, under lock */
+    size_t carry_len;
+    size_t carry_cap;
+    int node;                               /* NUMA node holding the ring and entry table */
     struct cdev cdev;                       /* Char device structure */
 };
 
+/*
+ * Per open file state
+ */
+struct aesd_file
+{
+    struct aesd_dev *dev;
+    bool follow;                            /* Reads at the end of data wait for new entries */
+    size_t stream_pos;                      /* Stream offset of f_pos while following */
+    uint32_t read_slot;                     /* Ring slot the last read ended in, a lookup hint */
+    struct mutex stage_lock;                /* Serializes writes through this file */
+    char *stage;                            /* Written bytes not yet ending in a newline */
+    size_t stage_len;
+    size_t stage_cap;
+};
+
+struct vm_area_struct;
+
+struct aesd_mmap_area *aesd_mmap_area_create(const struct aesd_circular_buffer *buffer, size_t data_size);
+void aesd_mmap_area_sync_add(struct aesd_mmap_area *area, const struct aesd_circular_buffer *buffer);
+void aesd_mmap_area_mark_stale(struct aesd_mmap_area *area);
+void aesd_mmap_area_put(struct aesd_mmap_area *area);
+int aesd_mmap_area_map(struct aesd_mmap_area *area, struct vm_area_struct *vma);
+
+int aesd_stats_init(struct aesd_dev *dev, struct dentry *parent, const char *name);
+void aesd_stats_exit(struct aesd_dev *dev);
+
 
 #endif /* AESD_CHAR_DRIVER_AESDCHAR_H_ */
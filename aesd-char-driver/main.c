@@ -17,58 +17,319 @@
 #include <linux/types.h>
 #include <linux/cdev.h>
 #include <linux/fs.h> // file_operations
+#include <linux/uio.h> // iov_iter
+#include <linux/splice.h>
+#include <linux/version.h>
 #include <linux/slab.h> // kmalloc, kfree
+#include <linux/mm.h> // kvmalloc_node, kvfree
+#include <linux/overflow.h> // array_size
+#include <linux/debugfs.h>
+#include <linux/vmalloc.h>
+#include <linux/moduleparam.h>
+#include <linux/rcupdate.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
 #include "aesdchar.h"
 #include "aesd_ioctl.h"
+#define CREATE_TRACE_POINTS
+#include "aesd_trace.h"
 int aesd_major =   0; // use dynamic major
 int aesd_minor =   0;
 
+#define AESDCHAR_MAX_DEVICES 256
+
+static unsigned int nr_devices = 1;
+module_param(nr_devices, uint, 0444);
+MODULE_PARM_DESC(nr_devices, "Number of devices, aesdchar0 and up, each with its own ring");
+
+static unsigned int ring_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+module_param(ring_entries, uint, 0444);
+MODULE_PARM_DESC(ring_entries, "Number of write commands retained (power of two values index with a mask)");
+
+static unsigned int ring_bytes = 1 << 20;
+module_param(ring_bytes, uint, 0444);
+MODULE_PARM_DESC(ring_bytes, "Size of the byte ring holding entry data, also the largest entry accepted");
+
+static unsigned int byte_budget;
+module_param(byte_budget, uint, 0644);
+MODULE_PARM_DESC(byte_budget, "Most bytes of entries retained, the newest entry excepted (0 for no limit beyond ring_bytes); applies from the next write");
+
+static unsigned int mmap_data_bytes = 1 << 20;
+module_param(mmap_data_bytes, uint, 0444);
+MODULE_PARM_DESC(mmap_data_bytes, "Bytes of history exposed through mmap, rounded up to a power of two (0 disables mmap)");
+
 MODULE_AUTHOR("Donald Posterick"); 
 MODULE_LICENSE("Dual BSD/GPL");
 
-struct aesd_dev aesd_device;
+struct aesd_dev **aesd_devices;
+static struct dentry *aesd_debugfs;             /* Holds a directory per device */
+
+/**
+ * Allocate a zeroed table of @param capacity entries on @param dev's node
+ */
+static struct aesd_buffer_entry *aesd_alloc_entries(struct aesd_dev *dev, uint32_t capacity)
+{
+    return kvmalloc_node(array_size(capacity, sizeof(struct aesd_buffer_entry)),
+                         GFP_KERNEL | __GFP_ZERO, dev->node);
+}
 
 int aesd_open(struct inode *inode, struct file *filp)
 {
-    struct aesd_dev *dev;
+    struct aesd_file *file;
     PDEBUG("open");
 
-    dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
-    filp->private_data = dev;
+    file = kzalloc(sizeof(*file), GFP_KERNEL);
+    if (!file)
+        return -ENOMEM;
+    file->dev = container_of(inode->i_cdev, struct aesd_dev, cdev);
+    mutex_init(&file->stage_lock);
+    filp->private_data = file;
 
     return 0;
 }
 
+/**
+ * Hand @param file's unterminated line to the device, where the next write through any file
+ * picks it up, as the assignment's single working entry would have kept it.  A partial line
+ * the device already holds comes first.
+ */
+static void aesd_carry_partial(struct aesd_dev *dev, struct aesd_file *file)
+{
+    char *carry;
+
+    mutex_lock(&dev->lock);
+    if (!dev->carry_len) {
+        kfree(dev->carry);
+        dev->carry = file->stage;
+        WRITE_ONCE(dev->carry_len, file->stage_len);
+        dev->carry_cap = file->stage_cap;
+        file->stage = NULL;
+    } else if (dev->carry_len + file->stage_len <= dev->data_size) {
+        carry = dev->carry;
+        if (dev->carry_cap < dev->carry_len + file->stage_len)
+            carry = krealloc(dev->carry, dev->carry_len + file->stage_len, GFP_KERNEL);
+        if (carry) {
+            memcpy(carry + dev->carry_len, file->stage, file->stage_len);
+            dev->carry = carry;
+            WRITE_ONCE(dev->carry_len, dev->carry_len + file->stage_len);
+            dev->carry_cap = max(dev->carry_cap, dev->carry_len);
+        }
+    }
+    mutex_unlock(&dev->lock);
+}
+
 int aesd_release(struct inode *inode, struct file *filp)
 {
+    struct aesd_file *file = filp->private_data;
     PDEBUG("release");
+
+    if (file->stage_len)
+        aesd_carry_partial(file->dev, file);
+    kfree(file->stage);
+    kfree(file);
     return 0;
 }
 
-static size_t aesd_get_total_size(struct aesd_circular_buffer *buffer)
+/**
+ * Copy the ring header into @param view, which may then be used with the circular buffer
+ * helpers once the seq read section that made the copy is validated.
+ */
+static void aesd_ring_view(const struct aesd_circular_buffer *buffer, struct aesd_circular_buffer *view)
+{
+    view->entry = READ_ONCE(buffer->entry);
+    view->capacity = READ_ONCE(buffer->capacity);
+    view->mask = READ_ONCE(buffer->mask);
+    view->in_offs = READ_ONCE(buffer->in_offs);
+    view->out_offs = READ_ONCE(buffer->out_offs);
+    view->full = READ_ONCE(buffer->full);
+    view->start_offset = READ_ONCE(buffer->start_offset);
+    view->end_offset = READ_ONCE(buffer->end_offset);
+    view->start_seq = READ_ONCE(buffer->start_seq);
+}
+
+/**
+ * @return the entry in slot @param slot of @param view if it holds stream offset @param offset.
+ * Slots of dropped entries hold older offsets, so a match is always a live entry.
+ */
+static struct aesd_buffer_entry *aesd_slot_holds(const struct aesd_circular_buffer *view,
+                                                 uint32_t slot, size_t offset)
 {
-    size_t total = 0;
-    uint8_t index;
     struct aesd_buffer_entry *entry;
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, buffer, index) {
-        if (entry->buffptr)
-            total += entry->size;
+
+    if (slot >= view->capacity)
+        return NULL;
+    entry = &view->entry[slot];
+    if (entry->offset <= offset && offset - entry->offset < entry->size)
+        return entry;
+    return NULL;
+}
+
+/**
+ * Lockless lookup of the entry holding a stream position.  Must be called inside an srcu
+ * read section, which keeps the entry table valid.  The bytes at @param snap's buffptr are
+ * only stable until the entry is dropped, see aesd_copy_span().
+ * @param pos the position to find, relative to the oldest byte, or a stream offset if @param absolute
+ * @param slot in: the slot the position is expected in, or the one before it, as a sequential
+ * reader finds it; out: the slot found.  A wrong guess costs a binary search.
+ * @return true with the entry copied to @param snap, its sequence number in @param entry_seq and
+ * the byte within it in @param entry_offset, false if the position is not in the buffer
+ */
+static bool aesd_snapshot_entry(struct aesd_dev *dev, size_t pos, bool absolute, uint32_t *slot,
+                                struct aesd_buffer_entry *snap, uint64_t *entry_seq, size_t *entry_offset)
+{
+    struct aesd_circular_buffer view;
+    struct aesd_buffer_entry *entry = NULL;
+    size_t rel, offset;
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_ring_view(&dev->buffer, &view);
+        /* Don't index the table until the header is known to be consistent */
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        entry = NULL;
+        rel = absolute ? pos - view.start_offset : pos;
+        if (rel >= aesd_circular_buffer_size(&view))
+            continue;
+        offset = view.start_offset + rel;
+
+        entry = aesd_slot_holds(&view, *slot, offset);
+        if (!entry && *slot < view.capacity)
+            entry = aesd_slot_holds(&view, aesd_circular_buffer_wrap(&view, *slot + 1), offset);
+        if (entry)
+            *entry_offset = offset - entry->offset;
+        else
+            entry = aesd_circular_buffer_find_entry_offset_for_fpos(&view, rel, entry_offset);
+
+        *slot = entry - view.entry;
+        *snap = *entry;
+        *entry_seq = view.start_seq +
+                     aesd_circular_buffer_wrap(&view, *slot + view.capacity - view.out_offs);
+    } while (read_seqcount_retry(&dev->seq, seq));
+
+    return entry != NULL;
+}
+
+/**
+ * Lockless copy of up to @param max consecutive entries into @param snap, starting with
+ * sequence number @param seq or, if that was dropped, the oldest entry.  Must be called inside
+ * an srcu read section.  @param view receives the ring header the entries were taken from and
+ * @param first_seq the sequence number of snap[0].
+ * @return the number of entries copied
+ */
+static uint32_t aesd_snapshot_entries(struct aesd_dev *dev, uint64_t seq, struct aesd_buffer_entry *snap,
+                                      uint32_t max, struct aesd_circular_buffer *view, uint64_t *first_seq)
+{
+    uint32_t count, skip, n, i;
+    unsigned int s;
+
+    do {
+        n = 0;
+        s = read_seqcount_begin(&dev->seq);
+        aesd_ring_view(&dev->buffer, view);
+        if (read_seqcount_retry(&dev->seq, s))
+            continue;
+        count = aesd_circular_buffer_count(view);
+        *first_seq = max_t(uint64_t, seq, view->start_seq);
+        if (*first_seq - view->start_seq < count) {
+            skip = *first_seq - view->start_seq;
+            n = min(max, count - skip);
+            for (i = 0; i < n; i++)
+                snap[i] = *aesd_circular_buffer_nth(view, skip + i);
+        }
+    } while (read_seqcount_retry(&dev->seq, s));
+
+    return n;
+}
+
+static size_t aesd_mmap_data_size(void)
+{
+    return roundup_pow_of_two(max_t(unsigned long, mmap_data_bytes, PAGE_SIZE));
+}
+
+/**
+ * Replace the mapped area after the ring layout changed.  Existing mappings see
+ * AESD_MMAP_STALE and keep the old area until they unmap.  Caller holds dev->lock.
+ */
+static void aesd_mmap_rebuild(struct aesd_dev *dev)
+{
+    struct aesd_mmap_area *old = rcu_dereference_protected(dev->mmap_area,
+                                                           lockdep_is_held(&dev->lock));
+    struct aesd_mmap_area *area = NULL;
+
+    if (mmap_data_bytes) {
+        area = aesd_mmap_area_create(&dev->buffer, aesd_mmap_data_size());
+        if (!area)
+            printk(KERN_WARNING "aesdchar: no memory for mmap area, mmap disabled\n");
+    }
+    rcu_assign_pointer(dev->mmap_area, area);
+    if (old) {
+        aesd_mmap_area_mark_stale(old);
+        aesd_mmap_area_put(old);
     }
-    return total;
 }
 
-loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+/**
+ * Read the stream offsets of the oldest byte and one past the newest byte without locking
+ */
+static void aesd_stream_bounds(struct aesd_dev *dev, size_t *start, size_t *end)
 {
-    struct aesd_dev *dev = filp->private_data;
-    loff_t newpos;
-    size_t total_size;
+    unsigned int seq;
 
-    PDEBUG("llseek offset %lld whence %d", offset, whence);
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        *start = READ_ONCE(dev->buffer.start_offset);
+        *end = READ_ONCE(dev->buffer.end_offset);
+    } while (read_seqcount_retry(&dev->seq, seq));
+}
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+static void aesd_seq_range(struct aesd_dev *dev, struct aesd_seq_range *range)
+{
+    struct aesd_circular_buffer view;
+    unsigned int seq;
+
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_ring_view(&dev->buffer, &view);
+    } while (read_seqcount_retry(&dev->seq, seq));
+
+    range->first_seq = view.start_seq;
+    range->next_seq = view.start_seq + aesd_circular_buffer_count(&view);
+    range->start = view.start_offset;
+    range->end = view.end_offset;
+}
 
-    total_size = aesd_get_total_size(&dev->buffer);
+/**
+ * @return the sequence number of the entry holding stream offset @param pos, the oldest entry's
+ * if @param pos has been dropped, or the next entry's if @param pos is at the end of the data
+ */
+static uint64_t aesd_seq_at(struct aesd_dev *dev, size_t pos)
+{
+    struct aesd_buffer_entry entry;
+    struct aesd_seq_range range;
+    size_t entry_offset;
+    uint32_t slot = 0;
+    uint64_t seq;
+    int idx;
+
+    idx = srcu_read_lock(&dev->srcu);
+    if (!aesd_snapshot_entry(dev, pos, true, &slot, &entry, &seq, &entry_offset)) {
+        aesd_seq_range(dev, &range);
+        seq = pos < range.start ? range.first_seq : range.next_seq;
+    }
+    srcu_read_unlock(&dev->srcu, idx);
+    return seq;
+}
+
+loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
+{
+    struct aesd_file *file = filp->private_data;
+    size_t start, end;
+    loff_t newpos;
+
+    aesd_stream_bounds(file->dev, &start, &end);
 
     switch (whence) {
     case SEEK_SET:
@@ -78,158 +339,759 @@ loff_t aesd_llseek(struct file *filp, loff_t offset, int whence)
         newpos = filp->f_pos + offset;
         break;
     case SEEK_END:
-        newpos = total_size + offset;
+        newpos = end - start + offset;
         break;
     default:
-        mutex_unlock(&dev->lock);
         return -EINVAL;
     }
 
-    if (newpos < 0) {
-        mutex_unlock(&dev->lock);
+    if (newpos < 0)
         return -EINVAL;
-    }
 
     filp->f_pos = newpos;
-    mutex_unlock(&dev->lock);
+    file->stream_pos = start + newpos;
+    aesd_stat_inc(file->dev, seeks);
+    if (trace_aesd_seek_enabled())
+        trace_aesd_seek(file->dev->cdev.dev, aesd_seq_at(file->dev, file->stream_pos), newpos,
+                        file->stream_pos);
     return newpos;
 }
 
-ssize_t aesd_read(struct file *filp, char __user *buf, size_t count,
-                loff_t *f_pos)
+/**
+ * Copy @param len ring bytes at @param src, which hold the stream bytes starting at
+ * @param stream_offset, to @param to.  Writers drop entries (advancing start_offset) before
+ * reusing their bytes, so the copy is good if start_offset has not passed it afterwards.
+ * @return 0, or -EFAULT or -EAGAIN (the bytes were dropped while copying) with @param to
+ * left as it was
+ */
+static int aesd_copy_span(struct aesd_dev *dev, struct iov_iter *to, const char *src, size_t len,
+                size_t stream_offset)
+{
+    size_t copied = copy_to_iter(src, len, to);
+
+    if (copied != len) {
+        iov_iter_revert(to, copied);
+        return -EFAULT;
+    }
+    smp_rmb();
+    if (READ_ONCE(dev->buffer.start_offset) > stream_offset) {
+        iov_iter_revert(to, len);
+        return -EAGAIN;
+    }
+    return 0;
+}
+
+/**
+ * Copy what is available at the read position without waiting.  Entries that sit
+ * back to back in the byte ring are copied with a single copy_to_iter().
+ * @param first_seq set to the sequence number of the entry the copy starts in
+ * @return bytes copied, 0 at the end of the data, or -EFAULT
+ */
+static ssize_t aesd_read_available(struct aesd_file *file, struct iov_iter *to, loff_t *f_pos,
+                                   uint64_t *first_seq)
 {
     ssize_t retval = 0;
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_buffer_entry *entry;
+    size_t count = iov_iter_count(to);
+    struct aesd_dev *dev = file->dev;
+    struct aesd_buffer_entry entry;
+    uint64_t entry_seq;
     size_t entry_offset;
     size_t bytes_to_read;
+    size_t copied = 0;
+    size_t start, end;
+    const char *span = NULL;
+    size_t span_len = 0;
+    size_t span_stream = 0;
+    uint32_t slot = READ_ONCE(file->read_slot);
+    bool found;
+    int err = 0;
+    int idx;
+
+    idx = srcu_read_lock(&dev->srcu);
+
+retry:
+    if (file->follow) {
+        /* Skip ahead if the entries at our position have been dropped */
+        aesd_stream_bounds(dev, &start, &end);
+        if (file->stream_pos < start)
+            file->stream_pos = start;
+        found = aesd_snapshot_entry(dev, file->stream_pos, true, &slot, &entry, first_seq,
+                                    &entry_offset);
+    } else {
+        found = aesd_snapshot_entry(dev, *f_pos, false, &slot, &entry, first_seq, &entry_offset);
+    }
+    if (!found)
+        goto out;
 
-    PDEBUG("read %zu bytes with offset %lld", count, *f_pos);
+    /*
+     * Continue by stream offset rather than by fpos so that entries evicted while we copy
+     * end the read instead of shifting it.
+     */
+    for (;;) {
+        if (span_len && entry.buffptr + entry_offset != span + span_len) {
+            err = aesd_copy_span(dev, to, span, span_len, span_stream);
+            if (err)
+                break;
+            copied += span_len;
+            file->stream_pos = span_stream + span_len;
+            span_len = 0;
+        }
+        if (!span_len) {
+            span = entry.buffptr + entry_offset;
+            span_stream = entry.offset + entry_offset;
+        }
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+        bytes_to_read = entry.size - entry_offset;
+        if (bytes_to_read > count - copied - span_len)
+            bytes_to_read = count - copied - span_len;
+        span_len += bytes_to_read;
 
-    entry = aesd_circular_buffer_find_entry_offset_for_fpos(&dev->buffer,
-                                                            *f_pos, &entry_offset);
-    if (entry == NULL) {
-        retval = 0;
-        goto out;
+        if (copied + span_len == count ||
+            !aesd_snapshot_entry(dev, entry.offset + entry.size, true, &slot, &entry, &entry_seq,
+                                 &entry_offset))
+            break;
+    }
+    if (!err && span_len) {
+        err = aesd_copy_span(dev, to, span, span_len, span_stream);
+        if (!err) {
+            copied += span_len;
+            file->stream_pos = span_stream + span_len;
+        }
     }
 
-    bytes_to_read = entry->size - entry_offset;
-    if (bytes_to_read > count)
-        bytes_to_read = count;
-
-    if (copy_to_user(buf, entry->buffptr + entry_offset, bytes_to_read)) {
-        retval = -EFAULT;
-        goto out;
+    /* Overtaken by writers before anything was copied: start over at the new position */
+    if (err == -EAGAIN && copied == 0) {
+        err = 0;
+        span_len = 0;
+        goto retry;
     }
+    if (err == -EFAULT && copied == 0)
+        retval = -EFAULT;
 
-    *f_pos += bytes_to_read;
-    retval = bytes_to_read;
+    if (copied) {
+        *f_pos += copied;
+        retval = copied;
+    }
 
 out:
-    mutex_unlock(&dev->lock);
+    srcu_read_unlock(&dev->srcu, idx);
+    WRITE_ONCE(file->read_slot, slot);
     return retval;
 }
 
-ssize_t aesd_write(struct file *filp, const char __user *buf, size_t count,
-                loff_t *f_pos)
+static bool aesd_follow_readable(struct aesd_file *file)
 {
-    ssize_t retval = -ENOMEM;
-    struct aesd_dev *dev = filp->private_data;
-    char *new_buffer;
-    const char *newline_ptr;
+    size_t start, end;
 
-    PDEBUG("write %zu bytes with offset %lld", count, *f_pos);
+    aesd_stream_bounds(file->dev, &start, &end);
+    return file->stream_pos < end;
+}
 
-    if (mutex_lock_interruptible(&dev->lock))
-        return -ERESTARTSYS;
+/**
+ * Serves read(), readv(), io_uring reads and, through splice_read, splice() and sendfile()
+ */
+ssize_t aesd_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+    struct file *filp = iocb->ki_filp;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    ssize_t retval;
+    uint64_t seq;
+    u64 start_ns;
+
+    for (;;) {
+        /* Time the copy only, not waiting for data */
+        start_ns = ktime_get_ns();
+        retval = aesd_read_available(file, to, &iocb->ki_pos, &seq);
+        if (retval != 0 || !file->follow || !iov_iter_count(to)) {
+            aesd_stat_inc(dev, reads);
+            if (retval > 0) {
+                aesd_stat_add(dev, read_bytes, retval);
+                trace_aesd_read(dev->cdev.dev, seq, file->stream_pos - retval, retval,
+                                ktime_get_ns() - start_ns);
+            }
+            aesd_stat_latency(dev, read_lat, start_ns);
+            return retval;
+        }
 
-    new_buffer = krealloc(dev->working_entry, dev->working_entry_size + count, GFP_KERNEL);
-    if (!new_buffer) {
-        retval = -ENOMEM;
-        goto out;
+        /* Following and at the end of the data: wait for the next entry */
+        if ((filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT))
+            return -EAGAIN;
+        if (wait_event_interruptible(dev->readq, aesd_follow_readable(file)))
+            return -ERESTARTSYS;
     }
-    dev->working_entry = new_buffer;
+}
 
-    if (copy_from_user(dev->working_entry + dev->working_entry_size, buf, count)) {
-        retval = -EFAULT;
+static __poll_t aesd_poll(struct file *filp, poll_table *wait)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    __poll_t mask = EPOLLOUT | EPOLLWRNORM;
+    size_t start, end;
+
+    poll_wait(filp, &dev->readq, wait);
+
+    aesd_stream_bounds(dev, &start, &end);
+    if (file->follow ? file->stream_pos < end : filp->f_pos < (loff_t)(end - start))
+        mask |= EPOLLIN | EPOLLRDNORM;
+    return mask;
+}
+
+/**
+ * mutex_lock_interruptible() on dev->lock, counting contention and the time spent waiting,
+ * which is also stored in @param wait_ns
+ */
+static int aesd_lock(struct aesd_dev *dev, u64 *wait_ns)
+{
+    u64 start;
+    int err;
+
+    *wait_ns = 0;
+    if (mutex_trylock(&dev->lock))
+        return 0;
+
+    start = ktime_get_ns();
+    err = mutex_lock_interruptible(&dev->lock);
+    *wait_ns = ktime_get_ns() - start;
+    aesd_stat_inc(dev, lock_contended);
+    aesd_stat_add(dev, lock_wait_ns, *wait_ns);
+    return err;
+}
+
+/**
+ * Drop the oldest entry.  Caller holds dev->lock inside a seq write section.
+ */
+static void aesd_evict_oldest(struct aesd_dev *dev)
+{
+    struct aesd_buffer_entry *entry = aesd_circular_buffer_remove_entry(&dev->buffer);
+
+    aesd_stat_inc(dev, evictions);
+    trace_aesd_evict(dev->cdev.dev, dev->buffer.start_seq - 1, entry->offset, entry->size);
+}
+
+/**
+ * Make the @param len bytes at data_head free, dropping the oldest entries as needed, and also
+ * until an entry of @param len bytes keeps the retained bytes within byte_budget.  If they
+ * would run past the end of the byte ring, data_head moves to the start of the ring instead so
+ * that every entry stays contiguous.  @param len must not exceed data_size.
+ * Caller holds dev->lock.
+ */
+static void aesd_ring_reserve(struct aesd_dev *dev, size_t len)
+{
+    struct aesd_circular_buffer *buffer = &dev->buffer;
+    size_t head = dev->data_head;
+    bool wrap = head + len > dev->data_size;
+    size_t claim = wrap ? dev->data_size - head + len : len;
+    size_t budget = READ_ONCE(byte_budget);
+    size_t tail, space;
+
+    /* The oldest entry begins the used part of the ring, which ends at head */
+    write_seqcount_begin(&dev->seq);
+    while (aesd_circular_buffer_count(buffer)) {
+        tail = buffer->entry[buffer->out_offs].buffptr - dev->data;
+        if (tail > head)
+            space = tail - head;
+        else
+            space = dev->data_size - head + tail;
+        if (tail != head && space >= claim &&
+            (!budget || aesd_circular_buffer_size(buffer) + len <= budget))
+            break;
+        aesd_evict_oldest(dev);
+    }
+    write_seqcount_end(&dev->seq);
+
+    if (wrap)
+        dev->data_head = 0;
+}
+
+/**
+ * Grow @param file's staging buffer to hold at least @param len bytes, doubling its capacity
+ */
+static int aesd_stage_grow(struct aesd_file *file, size_t len)
+{
+    size_t cap = max_t(size_t, file->stage_cap * 2, 64);
+    char *stage;
+
+    if (len <= file->stage_cap)
+        return 0;
+    if (cap < len)
+        cap = len;
+    stage = krealloc(file->stage, cap, GFP_KERNEL);
+    if (!stage)
+        return -ENOMEM;
+    file->stage = stage;
+    file->stage_cap = cap;
+    return 0;
+}
+
+/**
+ * Put the partial line a closed file left on the device in front of @param file's staged bytes.
+ * Caller holds file->stage_lock.
+ * @return 0, -ERESTARTSYS or -ENOMEM with the partial line left on the device
+ */
+static int aesd_adopt_carry(struct aesd_dev *dev, struct aesd_file *file)
+{
+    int retval = 0;
+
+    if (mutex_lock_interruptible(&dev->lock))
+        return -ERESTARTSYS;
+    if (!dev->carry_len)
         goto out;
+    if (!file->stage_len) {
+        swap(file->stage, dev->carry);
+        swap(file->stage_cap, dev->carry_cap);
+        file->stage_len = dev->carry_len;
+    } else if (dev->carry_len + file->stage_len > dev->data_size) {
+        /* Too long to ever commit, drop it as aesd_write_iter would */
+        file->stage_len = 0;
+    } else {
+        retval = aesd_stage_grow(file, dev->carry_len + file->stage_len);
+        if (retval)
+            goto out;
+        memmove(file->stage + dev->carry_len, file->stage, file->stage_len);
+        memcpy(file->stage, dev->carry, dev->carry_len);
+        file->stage_len += dev->carry_len;
     }
-    dev->working_entry_size += count;
+    WRITE_ONCE(dev->carry_len, 0);
+out:
+    mutex_unlock(&dev->lock);
+    return retval;
+}
+
+/**
+ * Move every complete line staged in @param file into the byte ring as an entry of its own.
+ * Bytes before @param scan are known to hold no newline.
+ * @return 0, or -ERESTARTSYS with the lines left staged
+ */
+static int aesd_commit_lines(struct aesd_dev *dev, struct aesd_file *file, size_t scan)
+{
+    struct aesd_buffer_entry new_entry;
+    struct aesd_buffer_entry *oldest;
+    struct aesd_mmap_area *area;
+    const char *newline_ptr;
+    size_t start = 0;
+    size_t len;
+    u64 wait_ns;
+    u64 now;
+
+    newline_ptr = memchr(file->stage + scan, '\n', file->stage_len - scan);
+    if (!newline_ptr)
+        return 0;
+
+    if (aesd_lock(dev, &wait_ns))
+        return -ERESTARTSYS;
 
-    newline_ptr = memchr(dev->working_entry, '\n', dev->working_entry_size);
-    if (newline_ptr) {
-        struct aesd_buffer_entry new_entry;
+    /* One commit time for every line of the write */
+    now = ktime_get_real_ns();
+    area = rcu_dereference_protected(dev->mmap_area, lockdep_is_held(&dev->lock));
+    do {
+        len = newline_ptr + 1 - (file->stage + start);
+        aesd_ring_reserve(dev, len);
+        memcpy(dev->data + dev->data_head, file->stage + start, len);
 
-        new_entry.buffptr = dev->working_entry;
-        new_entry.size = dev->working_entry_size;
+        new_entry.buffptr = dev->data + dev->data_head;
+        new_entry.size = len;
+        new_entry.timestamp = now;
 
         if (dev->buffer.full) {
-            kfree(dev->buffer.entry[dev->buffer.in_offs].buffptr);
+            /* add_entry() overwrites the oldest */
+            oldest = &dev->buffer.entry[dev->buffer.out_offs];
+            aesd_stat_inc(dev, evictions);
+            trace_aesd_evict(dev->cdev.dev, dev->buffer.start_seq, oldest->offset, oldest->size);
         }
-
+        write_seqcount_begin(&dev->seq);
         aesd_circular_buffer_add_entry(&dev->buffer, &new_entry);
+        write_seqcount_end(&dev->seq);
+        trace_aesd_commit(dev->cdev.dev,
+                          dev->buffer.start_seq + aesd_circular_buffer_count(&dev->buffer) - 1,
+                          dev->buffer.end_offset - len, len, wait_ns);
 
-        dev->working_entry = NULL;
-        dev->working_entry_size = 0;
-    }
+        if (area)
+            aesd_mmap_area_sync_add(area, &dev->buffer);
 
-    retval = count;
+        dev->data_head += len;
+        start += len;
+        newline_ptr = memchr(file->stage + start, '\n', file->stage_len - start);
+    } while (newline_ptr);
 
-out:
     mutex_unlock(&dev->lock);
+    wake_up_interruptible_poll(&dev->readq, EPOLLIN | EPOLLRDNORM);
+
+    file->stage_len -= start;
+    memmove(file->stage, file->stage + start, file->stage_len);
+    return 0;
+}
+
+/**
+ * Writes are staged per open file, so writers on different files do not mix their partial
+ * lines, and each line becomes an entry once its newline arrives.  A file closed in the middle
+ * of a line leaves it to the device, and the next write through any file continues it, so
+ * "echo -n a; echo b" still adds the single entry "ab\n".  A line longer than the byte ring is
+ * dropped and fails with -EFBIG.  Serves write(), writev() and, through
+ * splice_write, splice() into the device.
+ */
+ssize_t aesd_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+    ssize_t retval = 0;
+    struct aesd_file *file = iocb->ki_filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    size_t count = iov_iter_count(from);
+    size_t done = 0;
+    size_t piece, scan, copied;
+    u64 start_ns = ktime_get_ns();
+
+    if (mutex_lock_interruptible(&file->stage_lock))
+        return -ERESTARTSYS;
+
+    /* Unlocked peek: a partial line handed over after this belongs to the next write */
+    if (READ_ONCE(dev->carry_len)) {
+        retval = aesd_adopt_carry(dev, file);
+        if (retval) {
+            mutex_unlock(&file->stage_lock);
+            return retval;
+        }
+    }
+
+    while (done < count) {
+        piece = min(count - done, dev->data_size - file->stage_len);
+        if (!piece) {
+            /* The staged line can never fit, drop it */
+            file->stage_len = 0;
+            retval = -EFBIG;
+            break;
+        }
+        retval = aesd_stage_grow(file, file->stage_len + piece);
+        if (retval)
+            break;
+        copied = copy_from_iter(file->stage + file->stage_len, piece, from);
+        scan = file->stage_len;
+        file->stage_len += copied;
+        done += copied;
+
+        retval = aesd_commit_lines(dev, file, scan);
+        if (retval)
+            break;
+        if (copied != piece) {
+            retval = -EFAULT;
+            break;
+        }
+    }
+
+    if (file->stage_len)
+        aesd_stat_inc(dev, partial_writes);
+    mutex_unlock(&file->stage_lock);
+
+    aesd_stat_inc(dev, writes);
+    aesd_stat_add(dev, write_bytes, done);
+    aesd_stat_latency(dev, write_lat, start_ns);
+    if (done)
+        retval = done;
     return retval;
 }
 
 static long aesd_adjust_file_offset(struct file *filp, uint32_t write_cmd, uint32_t write_cmd_offset)
 {
-    struct aesd_dev *dev = filp->private_data;
-    struct aesd_circular_buffer *buffer = &dev->buffer;
-    loff_t newpos = 0;
-    uint32_t num_entries;
-    uint8_t entry_index;
-    uint32_t i;
-
-    /* Calculate number of valid entries */
-    if (buffer->full) {
-        num_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-    } else if (buffer->in_offs >= buffer->out_offs) {
-        num_entries = buffer->in_offs - buffer->out_offs;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_circular_buffer view;
+    struct aesd_buffer_entry entry;
+    uint64_t entry_seq;
+    unsigned int seq;
+    long retval;
+    int idx;
+
+    /* A resize may free the table the view points at once the srcu read section ends */
+    idx = srcu_read_lock(&dev->srcu);
+    do {
+        seq = read_seqcount_begin(&dev->seq);
+        aesd_ring_view(&dev->buffer, &view);
+        retval = -EINVAL;
+        if (read_seqcount_retry(&dev->seq, seq))
+            continue;
+
+        /* Validate write_cmd is in range */
+        if (write_cmd >= aesd_circular_buffer_count(&view))
+            continue;
+
+        entry = *aesd_circular_buffer_nth(&view, write_cmd);
+        entry_seq = view.start_seq + write_cmd;
+        retval = 0;
+    } while (read_seqcount_retry(&dev->seq, seq));
+    srcu_read_unlock(&dev->srcu, idx);
+
+    if (retval)
+        return retval;
+
+    /* Validate write_cmd_offset is in range */
+    if (write_cmd_offset >= entry.size)
+        return -EINVAL;
+
+    filp->f_pos = entry.offset - view.start_offset + write_cmd_offset;
+    file->stream_pos = entry.offset + write_cmd_offset;
+    aesd_stat_inc(dev, seeks);
+    trace_aesd_seek(dev->cdev.dev, entry_seq, filp->f_pos, file->stream_pos);
+    return 0;
+}
+
+/**
+ * Move to the first entry with sequence number at least @param seq, or to the end of the data.
+ * @return the sequence number of the entry moved to
+ */
+static uint64_t aesd_seek_seq(struct file *filp, uint64_t seq)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_circular_buffer view;
+    struct aesd_buffer_entry entry;
+    uint64_t first_seq;
+    size_t pos;
+    int idx;
+
+    idx = srcu_read_lock(&dev->srcu);
+    if (aesd_snapshot_entries(dev, seq, &entry, 1, &view, &first_seq)) {
+        pos = entry.offset;
     } else {
-        num_entries = AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED - buffer->out_offs + buffer->in_offs;
+        pos = view.end_offset;
+        first_seq = view.start_seq + aesd_circular_buffer_count(&view);
     }
+    srcu_read_unlock(&dev->srcu, idx);
 
-    /* Validate write_cmd is in range */
-    if (write_cmd >= num_entries)
-        return -EINVAL;
+    filp->f_pos = pos - view.start_offset;
+    file->stream_pos = pos;
+    aesd_stat_inc(dev, seeks);
+    trace_aesd_seek(dev->cdev.dev, first_seq, filp->f_pos, file->stream_pos);
+    return first_seq;
+}
 
-    /* Get the entry index in the circular buffer */
-    entry_index = (buffer->out_offs + write_cmd) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
+/**
+ * Change the ring capacity, keeping the newest entries
+ */
+static long aesd_resize(struct aesd_dev *dev, uint32_t capacity)
+{
+    struct aesd_buffer_entry *storage, *old_storage;
+    u64 wait_ns;
 
-    /* Validate write_cmd_offset is in range */
-    if (write_cmd_offset >= buffer->entry[entry_index].size)
+    if (capacity == 0 || capacity > AESDCHAR_MAX_RING_ENTRIES)
         return -EINVAL;
 
-    /* Sum up sizes of all entries before the target entry */
-    for (i = 0; i < write_cmd; i++) {
-        uint8_t idx = (buffer->out_offs + i) % AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED;
-        newpos += buffer->entry[idx].size;
+    storage = aesd_alloc_entries(dev, capacity);
+    if (!storage)
+        return -ENOMEM;
+
+    if (aesd_lock(dev, &wait_ns)) {
+        kvfree(storage);
+        return -ERESTARTSYS;
     }
-    newpos += write_cmd_offset;
 
-    filp->f_pos = newpos;
+    write_seqcount_begin(&dev->seq);
+    while (aesd_circular_buffer_count(&dev->buffer) > capacity)
+        aesd_evict_oldest(dev);
+    old_storage = dev->buffer.entry;
+    aesd_circular_buffer_migrate(&dev->buffer, storage, capacity);
+    write_seqcount_end(&dev->seq);
+    aesd_mmap_rebuild(dev);
+
+    mutex_unlock(&dev->lock);
+
+    /* Readers may still be searching the old table */
+    synchronize_srcu(&dev->srcu);
+    if (old_storage != dev->buffer.entry_inline)
+        kvfree(old_storage);
+    PDEBUG("resized ring to %u entries", capacity);
+    return 0;
+}
+
+#define AESD_TABLE_CHUNK 64
+
+/**
+ * AESDCHAR_IOCENTRIES: report entries a chunk at a time, each chunk a consistent snapshot
+ */
+static long aesd_entry_table(struct aesd_dev *dev, struct aesd_entry_table __user *arg)
+{
+    struct aesd_entry_table table;
+    struct aesd_circular_buffer view;
+    struct {
+        struct aesd_buffer_entry snap[AESD_TABLE_CHUNK];
+        struct aesd_entry_info info[AESD_TABLE_CHUNK];
+    } *chunk;
+    struct aesd_entry_info __user *out;
+    uint64_t seq, first_seq;
+    uint32_t done = 0;
+    uint32_t n, i;
+    long retval = 0;
+    int idx;
+
+    if (copy_from_user(&table, arg, sizeof(table)))
+        return -EFAULT;
+    out = u64_to_user_ptr(table.entries);
+
+    chunk = kmalloc(sizeof(*chunk), GFP_KERNEL);
+    if (!chunk)
+        return -ENOMEM;
+
+    seq = table.first_seq;
+    idx = srcu_read_lock(&dev->srcu);
+    for (;;) {
+        n = aesd_snapshot_entries(dev, seq, chunk->snap,
+                                  min_t(uint32_t, table.count - done, AESD_TABLE_CHUNK), &view, &first_seq);
+        if (done == 0) {
+            table.first_seq = first_seq;
+            table.start = view.start_offset;
+            table.next_seq = view.start_seq + aesd_circular_buffer_count(&view);
+        }
+        if (n == 0)
+            break;
+
+        for (i = 0; i < n; i++) {
+            chunk->info[i].seq = first_seq + i;
+            chunk->info[i].offset = chunk->snap[i].offset;
+            chunk->info[i].size = chunk->snap[i].size;
+            chunk->info[i].timestamp_ns = chunk->snap[i].timestamp;
+        }
+        if (copy_to_user(out + done, chunk->info, n * sizeof(chunk->info[0]))) {
+            retval = -EFAULT;
+            break;
+        }
+        done += n;
+        seq = first_seq + n;
+    }
+    srcu_read_unlock(&dev->srcu, idx);
+    kfree(chunk);
+
+    if (retval)
+        return retval;
+    table.count = done;
+    if (copy_to_user(arg, &table, sizeof(table)))
+        return -EFAULT;
     return 0;
 }
 
+/* Lock-free passes of AESDCHAR_IOCREADENTRIES before it holds writers off for the last one */
+#define AESD_READ_ENTRIES_RETRIES 4
+
+/**
+ * AESDCHAR_IOCREADENTRIES: copy whole entries without locking, then check that none of them
+ * was dropped meanwhile, as aesd_copy_span() does, and start over if one was. After
+ * AESD_READ_ENTRIES_RETRIES such passes the last one runs under dev->lock so that writers
+ * cannot keep overtaking it.
+ */
+static long aesd_read_entries(struct aesd_dev *dev, struct aesd_entry_read __user *arg)
+{
+    struct aesd_entry_read req;
+    struct aesd_circular_buffer view;
+    struct aesd_buffer_entry *snap;
+    struct aesd_entry_info info;
+    struct aesd_entry_info __user *out;
+    char __user *buf;
+    const char *span = NULL;
+    size_t span_len;
+    uint64_t first_seq;
+    uint64_t bytes;
+    uint32_t n, i;
+    unsigned int passes = 0;
+    bool locked = false;
+    u64 wait_ns;
+    long retval = 0;
+    int idx;
+
+    if (copy_from_user(&req, arg, sizeof(req)))
+        return -EFAULT;
+    if (req.count > AESDCHAR_MAX_READ_ENTRIES)
+        return -EINVAL;
+    buf = u64_to_user_ptr(req.buf);
+    out = u64_to_user_ptr(req.entries);
+
+    snap = kmalloc_array(max_t(uint32_t, req.count, 1), sizeof(*snap), GFP_KERNEL);
+    if (!snap)
+        return -ENOMEM;
+
+    idx = srcu_read_lock(&dev->srcu);
+retry:
+    n = aesd_snapshot_entries(dev, req.first_seq, snap, req.count, &view, &first_seq);
+
+    /* Only whole entries */
+    bytes = 0;
+    for (i = 0; i < n && snap[i].size <= req.bytes - bytes; i++)
+        bytes += snap[i].size;
+    if (i == 0 && n) {
+        bytes = snap[0].size;
+        retval = -EMSGSIZE;
+        goto out;
+    }
+    n = i;
+
+    bytes = 0;
+    span_len = 0;
+    for (i = 0; i <= n; i++) {
+        if (span_len && (i == n || snap[i].buffptr != span + span_len)) {
+            if (copy_to_user(buf + bytes, span, span_len)) {
+                retval = -EFAULT;
+                goto out;
+            }
+            bytes += span_len;
+            span_len = 0;
+        }
+        if (i == n)
+            break;
+        if (!span_len)
+            span = snap[i].buffptr;
+        span_len += snap[i].size;
+    }
+    smp_rmb();
+    if (!locked && n && READ_ONCE(dev->buffer.start_offset) > snap[0].offset) {
+        if (++passes == AESD_READ_ENTRIES_RETRIES) {
+            /* Resize drops dev->lock before synchronize_srcu(), so taking it here cannot deadlock */
+            if (aesd_lock(dev, &wait_ns)) {
+                retval = -ERESTARTSYS;
+                goto out;
+            }
+            locked = true;
+        }
+        goto retry;
+    }
+
+    if (out) {
+        for (i = 0; i < n; i++) {
+            info.seq = first_seq + i;
+            info.offset = snap[i].offset;
+            info.size = snap[i].size;
+            info.timestamp_ns = snap[i].timestamp;
+            if (copy_to_user(out + i, &info, sizeof(info))) {
+                retval = -EFAULT;
+                goto out;
+            }
+        }
+    }
+
+out:
+    if (locked)
+        mutex_unlock(&dev->lock);
+    srcu_read_unlock(&dev->srcu, idx);
+    kfree(snap);
+
+    if (retval && retval != -EMSGSIZE)
+        return retval;
+    req.first_seq = first_seq;
+    req.bytes = bytes;
+    req.count = retval ? 0 : n;
+    if (copy_to_user(arg, &req, sizeof(req)))
+        return -EFAULT;
+    return retval;
+}
+
 /**
- * ioctl handler for AESDCHAR_IOCSEEKTO command
+ * ioctl handler for the AESDCHAR_IOC* commands in aesd_ioctl.h
  */
 long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
-    struct aesd_dev *dev = filp->private_data;
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
     struct aesd_seekto seekto;
+    struct aesd_seekseq seekseq;
+    struct aesd_seq_range range;
+    uint32_t capacity;
+    uint32_t follow;
+    size_t start, end;
     long retval = 0;
 
     if (_IOC_TYPE(cmd) != AESD_IOC_MAGIC)
@@ -242,11 +1104,46 @@ long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
         if (copy_from_user(&seekto, (const void __user *)arg, sizeof(seekto)))
             return -EFAULT;
 
-        if (mutex_lock_interruptible(&dev->lock))
-            return -ERESTARTSYS;
-
         retval = aesd_adjust_file_offset(filp, seekto.write_cmd, seekto.write_cmd_offset);
-        mutex_unlock(&dev->lock);
+        break;
+
+    case AESDCHAR_IOCRESIZE:
+        if (copy_from_user(&capacity, (const void __user *)arg, sizeof(capacity)))
+            return -EFAULT;
+
+        retval = aesd_resize(dev, capacity);
+        break;
+
+    case AESDCHAR_IOCFOLLOW:
+        if (copy_from_user(&follow, (const void __user *)arg, sizeof(follow)))
+            return -EFAULT;
+
+        aesd_stream_bounds(dev, &start, &end);
+        file->stream_pos = start + filp->f_pos;
+        file->follow = follow != 0;
+        break;
+
+    case AESDCHAR_IOCENTRIES:
+        retval = aesd_entry_table(dev, (struct aesd_entry_table __user *)arg);
+        break;
+
+    case AESDCHAR_IOCREADENTRIES:
+        retval = aesd_read_entries(dev, (struct aesd_entry_read __user *)arg);
+        break;
+
+    case AESDCHAR_IOCSEEKSEQ:
+        if (copy_from_user(&seekseq, (const void __user *)arg, sizeof(seekseq)))
+            return -EFAULT;
+
+        seekseq.seq = aesd_seek_seq(filp, seekseq.seq);
+        if (copy_to_user((void __user *)arg, &seekseq, sizeof(seekseq)))
+            return -EFAULT;
+        break;
+
+    case AESDCHAR_IOCSEQRANGE:
+        aesd_seq_range(dev, &range);
+        if (copy_to_user((void __user *)arg, &range, sizeof(range)))
+            return -EFAULT;
         break;
 
     default:
@@ -256,73 +1153,243 @@ long aesd_unlocked_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
     return retval;
 }
 
+/**
+ * Map the history read-only, see aesd_mmap.h
+ */
+static int aesd_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    struct aesd_file *file = filp->private_data;
+    struct aesd_dev *dev = file->dev;
+    struct aesd_mmap_area *area;
+    int err;
+
+    /*
+     * mmap_lock is held here, and the locked pass of AESDCHAR_IOCREADENTRIES can fault in
+     * copy_to_user() under dev->lock, so taking dev->lock here would invert that order.
+     * Pick up the current area under RCU instead.
+     */
+    rcu_read_lock();
+    area = rcu_dereference(dev->mmap_area);
+    if (area && !kref_get_unless_zero(&area->ref))
+        area = NULL;
+    rcu_read_unlock();
+    if (!area)
+        return -ENODEV;
+
+    err = aesd_mmap_area_map(area, vma);
+    if (err)
+        aesd_mmap_area_put(area);
+    return err;
+}
+
 struct file_operations aesd_fops = {
     .owner =          THIS_MODULE,
-    .read =           aesd_read,
-    .write =          aesd_write,
+    .read_iter =      aesd_read_iter,
+    .write_iter =     aesd_write_iter,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+    .splice_read =    copy_splice_read,
+#else
+    .splice_read =    generic_file_splice_read,
+#endif
+    .splice_write =   iter_file_splice_write,
     .open =           aesd_open,
     .release =        aesd_release,
     .llseek =         aesd_llseek,
+    .poll =           aesd_poll,
     .unlocked_ioctl = aesd_unlocked_ioctl,
+    .mmap =           aesd_mmap,
 };
 
-static int aesd_setup_cdev(struct aesd_dev *dev)
+static int aesd_setup_cdev(struct aesd_dev *dev, unsigned int index)
 {
-    int err, devno = MKDEV(aesd_major, aesd_minor);
+    int err, devno = MKDEV(aesd_major, aesd_minor + index);
 
     cdev_init(&dev->cdev, &aesd_fops);
     dev->cdev.owner = THIS_MODULE;
     dev->cdev.ops = &aesd_fops;
     err = cdev_add (&dev->cdev, devno, 1);
     if (err) {
-        printk(KERN_ERR "Error %d adding aesd cdev", err);
+        printk(KERN_ERR "Error %d adding aesd cdev %u", err, index);
     }
     return err;
 }
 
+/**
+ * @return the NUMA node of device @param index; devices are spread over the online nodes in turn
+ */
+static int aesd_dev_node(unsigned int index)
+{
+    unsigned int n = index % num_online_nodes();
+    int node;
+
+    for_each_online_node(node) {
+        if (n-- == 0)
+            return node;
+    }
+    return NUMA_NO_NODE;
+}
+
+/**
+ * Allocate and register device @param index, with its ring, entry table and statistics on
+ * its own node
+ * @return the device or an ERR_PTR()
+ */
+static struct aesd_dev *aesd_dev_create(unsigned int index)
+{
+    int node = aesd_dev_node(index);
+    int result = -ENOMEM;
+    struct aesd_dev *dev;
+    struct aesd_buffer_entry *storage;
+    struct aesd_mmap_area *area = NULL;
+    char name[24];
+
+    dev = kzalloc_node(sizeof(*dev), GFP_KERNEL, node);
+    if (!dev)
+        return ERR_PTR(-ENOMEM);
+    dev->node = node;
+
+    dev->data = vmalloc_node(ring_bytes, node);
+    if (!dev->data)
+        goto fail_data;
+    dev->data_size = ring_bytes;
+
+    storage = aesd_alloc_entries(dev, ring_entries);
+    if (!storage)
+        goto fail_storage;
+
+    result = init_srcu_struct(&dev->srcu);
+    if (result)
+        goto fail_srcu;
+
+    snprintf(name, sizeof(name), "aesdchar%u", index);
+    result = aesd_stats_init(dev, aesd_debugfs, name);
+    if (result)
+        goto fail_stats;
+
+    mutex_init(&dev->lock);
+    init_waitqueue_head(&dev->readq);
+    seqcount_mutex_init(&dev->seq, &dev->lock);
+    aesd_circular_buffer_init_storage(&dev->buffer, storage, ring_entries);
+
+    if (mmap_data_bytes) {
+        area = aesd_mmap_area_create(&dev->buffer, aesd_mmap_data_size());
+        if (!area) {
+            result = -ENOMEM;
+            goto fail_area;
+        }
+        RCU_INIT_POINTER(dev->mmap_area, area);
+    }
+
+    result = aesd_setup_cdev(dev, index);
+    if (!result)
+        return dev;
+
+    if (area)
+        aesd_mmap_area_put(area);
+    rcu_barrier();
+fail_area:
+    aesd_stats_exit(dev);
+fail_stats:
+    cleanup_srcu_struct(&dev->srcu);
+fail_srcu:
+    kvfree(storage);
+fail_storage:
+    vfree(dev->data);
+fail_data:
+    kfree(dev);
+    return ERR_PTR(result);
+}
 
+static void aesd_dev_destroy(struct aesd_dev *dev)
+{
+    struct aesd_mmap_area *area;
+
+    cdev_del(&dev->cdev);
+
+    /* No file is open, so no mapping holds the area either */
+    area = rcu_dereference_protected(dev->mmap_area, 1);
+    RCU_INIT_POINTER(dev->mmap_area, NULL);
+    if (area)
+        aesd_mmap_area_put(area);
+    rcu_barrier();
+
+    /* There are no readers left */
+    if (dev->buffer.entry != dev->buffer.entry_inline)
+        kvfree(dev->buffer.entry);
+    cleanup_srcu_struct(&dev->srcu);
+    kfree(dev->carry);
+    vfree(dev->data);
+    aesd_stats_exit(dev);
+    kfree(dev);
+}
 
 int aesd_init_module(void)
 {
     dev_t dev = 0;
     int result;
-    result = alloc_chrdev_region(&dev, aesd_minor, 1,
+    unsigned int i;
+    struct aesd_dev *adev;
+
+    if (ring_entries == 0 || ring_entries > AESDCHAR_MAX_RING_ENTRIES) {
+        printk(KERN_WARNING "aesdchar: invalid ring_entries %u\n", ring_entries);
+        return -EINVAL;
+    }
+    if (ring_bytes == 0) {
+        printk(KERN_WARNING "aesdchar: invalid ring_bytes %u\n", ring_bytes);
+        return -EINVAL;
+    }
+    if (nr_devices == 0 || nr_devices > AESDCHAR_MAX_DEVICES) {
+        printk(KERN_WARNING "aesdchar: invalid nr_devices %u\n", nr_devices);
+        return -EINVAL;
+    }
+
+    result = alloc_chrdev_region(&dev, aesd_minor, nr_devices,
             "aesdchar");
     aesd_major = MAJOR(dev);
     if (result < 0) {
         printk(KERN_WARNING "Can't get major %d\n", aesd_major);
         return result;
     }
-    memset(&aesd_device,0,sizeof(struct aesd_dev));
 
-    mutex_init(&aesd_device.lock);
-    aesd_circular_buffer_init(&aesd_device.buffer);
-
-    result = aesd_setup_cdev(&aesd_device);
+    aesd_devices = kcalloc(nr_devices, sizeof(*aesd_devices), GFP_KERNEL);
+    if (!aesd_devices) {
+        result = -ENOMEM;
+        goto fail_devices;
+    }
+    aesd_debugfs = debugfs_create_dir("aesdchar", NULL);
 
-    if( result ) {
-        unregister_chrdev_region(dev, 1);
+    for (i = 0; i < nr_devices; i++) {
+        adev = aesd_dev_create(i);
+        if (IS_ERR(adev)) {
+            result = PTR_ERR(adev);
+            goto fail_create;
+        }
+        aesd_devices[i] = adev;
     }
+    return 0;
+
+fail_create:
+    while (i--)
+        aesd_dev_destroy(aesd_devices[i]);
+    debugfs_remove_recursive(aesd_debugfs);
+    kfree(aesd_devices);
+fail_devices:
+    unregister_chrdev_region(dev, nr_devices);
     return result;
 
 }
 
 void aesd_cleanup_module(void)
 {
-    uint8_t index;
-    struct aesd_buffer_entry *entry;
     dev_t devno = MKDEV(aesd_major, aesd_minor);
+    unsigned int i;
 
-    cdev_del(&aesd_device.cdev);
-
-    AESD_CIRCULAR_BUFFER_FOREACH(entry, &aesd_device.buffer, index) {
-        if (entry->buffptr)
-            kfree(entry->buffptr);
-    }
-
-    kfree(aesd_device.working_entry);
+    for (i = 0; i < nr_devices; i++)
+        aesd_dev_destroy(aesd_devices[i]);
+    debugfs_remove_recursive(aesd_debugfs);
+    kfree(aesd_devices);
 
-    unregister_chrdev_region(devno, 1);
+    unregister_chrdev_region(devno, nr_devices);
 }
 
 
@@ -0,0 +1,602 @@
+/*
+ * aesdchar_stress.c
+ *
+ * Runs the aesdchar driver (main.c and friends, built against kshim/) in user space with
+ * concurrent writers, scanning readers, seeking readers, entry readers, followers and
+ * resizers, checks every line read, and reports throughput per role.
+ *
+ * Writers write fixed length lines "w<id> <seq> <fill>\n", by default one write each. With -c
+ * they write their stream in pieces of random length instead, so that lines are staged across
+ * writes and one write can commit several. Either way every entry is one line, every line
+ * boundary sits at a multiple of the line length and, within one read, each writer's lines
+ * must appear with consecutive sequence numbers.
+ *
+ * Entry readers list entries with AESDCHAR_IOCENTRIES and read them with
+ * AESDCHAR_IOCREADENTRIES, and check that the entries reported are consecutive and that each
+ * entry read back is one intact line. Followers read in follow mode with O_NONBLOCK and poll
+ * while there is nothing new. Resizers change the ring capacity with AESDCHAR_IOCRESIZE and
+ * switch byte_budget on and off while all of that runs.
+ */
+
+#include <linux/fs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "aesdchar.h"
+#include "aesd_ioctl.h"
+
+#define MAX_WRITERS 64
+#define MIN_LINE_LEN 24
+#define READ_BUF_SIZE (1 << 16)
+#define MAX_WRITE_CHUNK (1 << 20)
+
+extern struct file_operations aesd_fops;
+extern struct aesd_dev **aesd_devices;
+void *kshim_param_ring_entries(void);
+void *kshim_param_ring_bytes(void);
+void *kshim_param_byte_budget(void);
+
+enum role { ROLE_WRITER, ROLE_READER, ROLE_SEEKER, ROLE_ENTRIES, ROLE_FOLLOWER, ROLE_RESIZER, ROLE_MAX };
+
+static const char *role_names[ROLE_MAX] = { "write", "read", "seek", "entry", "follow", "resize" };
+
+struct worker {
+    pthread_t thread;
+    enum role role;
+    unsigned int id;
+    uint64_t ops;
+    uint64_t bytes;
+    uint64_t misses;                    /* Seeks whose target was evicted first, empty entry reads,
+                                           follower reads that found nothing new */
+};
+
+static size_t line_len = 64;
+static size_t write_chunk;              /* 0: one line per write, else 1 to write_chunk bytes */
+static unsigned int nr_writers = 4;
+static volatile bool stop;
+static volatile bool failed;
+
+static void fail(const char *what, const char *line, size_t len)
+{
+    if (!__atomic_exchange_n(&failed, true, __ATOMIC_SEQ_CST))
+        fprintf(stderr, "%s: \"%.*s\"\n", what, (int)len, line);
+    stop = true;
+}
+
+static void format_line(char *line, unsigned int id, uint64_t seq)
+{
+    int n = snprintf(line, line_len, "w%u %llu ", id, (unsigned long long)seq);
+
+    memset(line + n, 'a' + seq % 26, line_len - 1 - n);
+    line[line_len - 1] = '\n';
+}
+
+/*
+ * Check one whole line and return its writer and sequence number
+ */
+static bool parse_line(const char *line, unsigned int *id, uint64_t *seq)
+{
+    char expect[4096];
+    unsigned long long s;
+
+    if (sscanf(line, "w%u %llu ", id, &s) != 2 || *id >= nr_writers)
+        return false;
+    *seq = s;
+    format_line(expect, *id, *seq);
+    return memcmp(line, expect, line_len) == 0;
+}
+
+/*
+ * Check the whole lines in @param buf, which starts @param skip bytes into a line and holds
+ * contiguous stream data: each writer's sequence numbers must be consecutive
+ */
+static void check_lines(const char *buf, size_t len, size_t skip)
+{
+    uint64_t last[MAX_WRITERS];
+    bool seen[MAX_WRITERS] = { false };
+    unsigned int id;
+    uint64_t seq;
+    size_t pos;
+
+    for (pos = skip ? line_len - skip : 0; pos + line_len <= len; pos += line_len)
+    {
+        if (!parse_line(buf + pos, &id, &seq))
+        {
+            fail("corrupt line", buf + pos, line_len);
+            return;
+        }
+        if (seen[id] && seq != last[id] + 1)
+        {
+            fail("lines out of order", buf + pos, line_len);
+            return;
+        }
+        seen[id] = true;
+        last[id] = seq;
+    }
+}
+
+/*
+ * Check @param n entries reported by AESDCHAR_IOCENTRIES or AESDCHAR_IOCREADENTRIES: one line
+ * each, in order, and with the stream offsets their sequence numbers imply. Entries reported
+ * by AESDCHAR_IOCREADENTRIES must also be @param consecutive.
+ */
+static void check_entries(const struct aesd_entry_info *info, uint32_t n, bool consecutive)
+{
+    char what[128];
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+    {
+        if (info[i].size != line_len || info[i].offset % line_len)
+        {
+            snprintf(what, sizeof(what), "seq %llu at %llu size %llu", (unsigned long long)info[i].seq,
+                     (unsigned long long)info[i].offset, (unsigned long long)info[i].size);
+            fail("bad entry", what, strlen(what));
+            return;
+        }
+        if (i == 0)
+            continue;
+        if (info[i].seq <= info[i - 1].seq || (consecutive && info[i].seq != info[i - 1].seq + 1) ||
+            info[i].offset - info[i - 1].offset != (info[i].seq - info[i - 1].seq) * line_len)
+        {
+            snprintf(what, sizeof(what), "seq %llu at %llu after seq %llu at %llu",
+                     (unsigned long long)info[i].seq, (unsigned long long)info[i].offset,
+                     (unsigned long long)info[i - 1].seq, (unsigned long long)info[i - 1].offset);
+            fail("entries not consecutive", what, strlen(what));
+            return;
+        }
+    }
+}
+
+/* Writes the lines of writer w->id in order, whole or in pieces of up to write_chunk bytes */
+static void *writer_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct file filp;
+    char *pending = malloc(write_chunk + line_len);
+    unsigned int seed = w->id;
+    size_t have = 0, len;
+    uint64_t seq = 0;
+    loff_t pos;
+
+    if (!pending || kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+    {
+        free(pending);
+        return NULL;
+    }
+    while (!stop)
+    {
+        len = write_chunk ? 1 + rand_r(&seed) % write_chunk : line_len;
+        for (; have < len; have += line_len)
+            format_line(pending + have, w->id, seq++);
+        pos = 0;
+        if (kshim_write(&aesd_fops, &filp, pending, len, &pos) != (ssize_t)len)
+        {
+            fail("short write", pending, len < line_len ? len : line_len);
+            break;
+        }
+        memmove(pending, pending + len, have - len);
+        have -= len;
+        w->ops++;
+        w->bytes += len;
+    }
+    /* Finish the line in progress: the device would hand it to whichever writer comes next */
+    len = have % line_len;
+    pos = 0;
+    if (len && !failed && kshim_write(&aesd_fops, &filp, pending, len, &pos) != (ssize_t)len)
+        fail("short write", pending, len);
+    kshim_release(&aesd_fops, &filp);
+    free(pending);
+    return NULL;
+}
+
+/* Reads the device start to end, over and over */
+static void *reader_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct file filp;
+    char *buf = malloc(READ_BUF_SIZE);
+    ssize_t n;
+
+    if (!buf || kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+    {
+        free(buf);
+        return NULL;
+    }
+    while (!stop)
+    {
+        filp.f_pos = 0;
+        while (!stop)
+        {
+            size_t skip = filp.f_pos % line_len;
+
+            n = kshim_read(&aesd_fops, &filp, buf, READ_BUF_SIZE, &filp.f_pos);
+            if (n <= 0)
+                break;
+            check_lines(buf, n, skip);
+            w->ops++;
+            w->bytes += n;
+        }
+    }
+    kshim_release(&aesd_fops, &filp);
+    free(buf);
+    return NULL;
+}
+
+/* Jumps to random entries, by file position, by write command and by sequence number, and
+ * reads one line from each */
+static void *seeker_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct file filp;
+    char line[4096];
+    unsigned int seed = w->id, id;
+    struct aesd_seq_range range;
+    struct aesd_seekseq seekseq;
+    struct aesd_seekto seekto;
+    uint64_t entries, seq;
+    long ret = 0;
+    ssize_t n;
+
+    if (kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+        return NULL;
+    while (!stop)
+    {
+        aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCSEQRANGE, (unsigned long)&range);
+        entries = range.next_seq - range.first_seq;
+        if (entries == 0)
+        {
+            sched_yield();
+            continue;
+        }
+
+        switch (w->ops % 3)
+        {
+        case 0:
+            ret = aesd_fops.llseek(&filp, (rand_r(&seed) % entries) * line_len, SEEK_SET);
+            break;
+        case 1:
+            seekto.write_cmd = rand_r(&seed) % entries;
+            seekto.write_cmd_offset = 0;
+            ret = aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCSEEKTO, (unsigned long)&seekto);
+            break;
+        case 2:
+            seekseq.seq = range.first_seq + rand_r(&seed) % entries;
+            ret = aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCSEEKSEQ, (unsigned long)&seekseq);
+            break;
+        }
+        w->ops++;
+
+        /* Entries evicted after the range was taken make the seek fail or land past the end */
+        n = ret < 0 ? 0 : kshim_read(&aesd_fops, &filp, line, line_len, &filp.f_pos);
+        if (n == (ssize_t)line_len)
+        {
+            if (!parse_line(line, &id, &seq))
+                fail("corrupt line after seek", line, line_len);
+            w->bytes += n;
+        }
+        else
+        {
+            w->misses++;
+        }
+    }
+    kshim_release(&aesd_fops, &filp);
+    return NULL;
+}
+
+/* Walks the entries from the oldest to the newest with AESDCHAR_IOCREADENTRIES, listing the
+ * same entries with AESDCHAR_IOCENTRIES before each read, and starts over at the oldest when
+ * it catches up */
+static void *entries_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct file filp;
+    struct aesd_entry_info *info = malloc(AESDCHAR_MAX_READ_ENTRIES * sizeof(*info));
+    char *buf = malloc(READ_BUF_SIZE);
+    struct aesd_entry_table table;
+    struct aesd_entry_read req;
+    uint64_t seq = 0, bytes;
+    uint32_t count, i;
+    long ret;
+
+    if (!info || !buf || kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+    {
+        free(buf);
+        free(info);
+        return NULL;
+    }
+    while (!stop)
+    {
+        if (w->ops % 2 == 0)
+        {
+            table.first_seq = seq;
+            table.entries = (uintptr_t)info;
+            table.count = AESDCHAR_MAX_READ_ENTRIES;
+            ret = aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCENTRIES, (unsigned long)&table);
+            if (ret)
+            {
+                fail("AESDCHAR_IOCENTRIES failed", strerror(-ret), strlen(strerror(-ret)));
+                break;
+            }
+            count = table.count;
+            check_entries(info, count, false);
+            if (count && (info[0].seq != table.first_seq || table.first_seq < seq))
+                fail("AESDCHAR_IOCENTRIES started at the wrong entry", "", 0);
+            w->bytes += count * sizeof(*info);
+        }
+        else
+        {
+            req.first_seq = seq;
+            req.buf = (uintptr_t)buf;
+            req.bytes = READ_BUF_SIZE;
+            req.entries = (uintptr_t)info;
+            req.count = AESDCHAR_MAX_READ_ENTRIES;
+            ret = aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCREADENTRIES, (unsigned long)&req);
+            if (ret)
+            {
+                fail("AESDCHAR_IOCREADENTRIES failed", strerror(-ret), strlen(strerror(-ret)));
+                break;
+            }
+            count = req.count;
+            check_entries(info, count, true);
+            if (count && (info[0].seq != req.first_seq || req.first_seq < seq))
+                fail("AESDCHAR_IOCREADENTRIES started at the wrong entry", "", 0);
+            bytes = 0;
+            for (i = 0; i < count && !failed; i++)
+            {
+                unsigned int id;
+                uint64_t line_seq;
+
+                if (!parse_line(buf + bytes, &id, &line_seq))
+                    fail("corrupt entry", buf + bytes, line_len);
+                bytes += info[i].size;
+            }
+            if (bytes != req.bytes)
+                fail("AESDCHAR_IOCREADENTRIES byte count does not match its entries", "", 0);
+            check_lines(buf, req.bytes, 0);
+            w->bytes += req.bytes;
+
+            if (count == 0)
+            {
+                w->misses++;
+                seq = 0;
+                sched_yield();
+            }
+            else
+            {
+                seq = info[count - 1].seq + 1;
+            }
+        }
+        w->ops++;
+    }
+    kshim_release(&aesd_fops, &filp);
+    free(buf);
+    free(info);
+    return NULL;
+}
+
+/* Follows the newest entries with non-blocking reads in follow mode, polling while there is
+ * nothing new.  Reads are a whole number of lines, so they start and end on line boundaries. */
+static void *follower_thread(void *arg)
+{
+    struct worker *w = arg;
+    struct file filp;
+    char *buf = malloc(READ_BUF_SIZE);
+    size_t count = READ_BUF_SIZE / line_len * line_len;
+    uint32_t follow = 1;
+    ssize_t n;
+
+    if (!buf || kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+    {
+        free(buf);
+        return NULL;
+    }
+    filp.f_flags |= O_NONBLOCK;
+    if (aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCFOLLOW, (unsigned long)&follow))
+        fail("AESDCHAR_IOCFOLLOW failed", "", 0);
+    while (!stop)
+    {
+        n = kshim_read(&aesd_fops, &filp, buf, count, &filp.f_pos);
+        if (n == -EAGAIN)
+        {
+            w->misses++;
+            while (!stop && !(aesd_fops.poll(&filp, NULL) & EPOLLIN))
+                sched_yield();
+            continue;
+        }
+        if (n <= 0)
+        {
+            fail("follow read failed", strerror(-n), strlen(strerror(-n)));
+            break;
+        }
+        if (n % line_len)
+            fail("follow read ended inside a line", buf + n / line_len * line_len, n % line_len);
+        check_lines(buf, n, 0);
+        w->ops++;
+        w->bytes += n;
+    }
+    kshim_release(&aesd_fops, &filp);
+    free(buf);
+    return NULL;
+}
+
+/* Changes the ring capacity, dropping the oldest entries when it shrinks, and switches
+ * byte_budget between off and a few lines' worth */
+static void *resizer_thread(void *arg)
+{
+    static const uint32_t capacities[] = { 1, 2, 3, 10, 64, 100, 1024, 4096 };
+    unsigned int *byte_budget = kshim_param_byte_budget();
+    struct worker *w = arg;
+    struct file filp;
+    unsigned int seed = w->id;
+    unsigned int budget;
+    uint32_t capacity;
+    long ret;
+
+    if (kshim_open(&aesd_fops, &aesd_devices[0]->cdev, &filp))
+        return NULL;
+    while (!stop)
+    {
+        capacity = capacities[rand_r(&seed) % (sizeof(capacities) / sizeof(capacities[0]))];
+        ret = aesd_fops.unlocked_ioctl(&filp, AESDCHAR_IOCRESIZE, (unsigned long)&capacity);
+        if (ret)
+        {
+            fail("AESDCHAR_IOCRESIZE failed", strerror(-ret), strlen(strerror(-ret)));
+            break;
+        }
+        budget = w->ops % 2 ? 0 : line_len * (1 + rand_r(&seed) % 64);
+        __atomic_store_n(byte_budget, budget, __ATOMIC_RELAXED);
+        w->ops++;
+        usleep(1000);
+    }
+    __atomic_store_n(byte_budget, 0, __ATOMIC_RELAXED);
+    kshim_release(&aesd_fops, &filp);
+    return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+    static void *(*const thread_fn[ROLE_MAX])(void *) = {
+        writer_thread, reader_thread, seeker_thread, entries_thread, follower_thread, resizer_thread
+    };
+    unsigned int nr_readers = 4, nr_seekers = 2, nr_entries = 1, nr_followers = 1, nr_resizers = 0;
+    unsigned int seconds = 2;
+    unsigned int count[ROLE_MAX];
+    struct worker *workers;
+    size_t nr_workers, i;
+    uint64_t start_ns, elapsed_ns;
+    bool verbose = false;
+    int opt_char;
+
+    // -w/-r/-s/-i/-f/-z <n>: writer, reader, seeker, entry reader, follower and resizer threads,
+    // -t <s>: run time, -l <bytes>: line length, -c <bytes>: write lines in pieces of 1 to
+    // <bytes>, -e <n>: ring_entries, -b <bytes>: ring_bytes, -v: print the device statistics
+    while ((opt_char = getopt(argc, argv, "w:r:s:i:f:z:t:l:c:e:b:v")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'w':
+            nr_writers = strtoul(optarg, NULL, 10);
+            break;
+        case 'r':
+            nr_readers = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            nr_seekers = strtoul(optarg, NULL, 10);
+            break;
+        case 'i':
+            nr_entries = strtoul(optarg, NULL, 10);
+            break;
+        case 'f':
+            nr_followers = strtoul(optarg, NULL, 10);
+            break;
+        case 'z':
+            nr_resizers = strtoul(optarg, NULL, 10);
+            break;
+        case 't':
+            seconds = strtoul(optarg, NULL, 10);
+            break;
+        case 'l':
+            line_len = strtoul(optarg, NULL, 10);
+            break;
+        case 'c':
+            write_chunk = strtoul(optarg, NULL, 10);
+            break;
+        case 'e':
+            *(unsigned int *)kshim_param_ring_entries() = strtoul(optarg, NULL, 10);
+            break;
+        case 'b':
+            *(unsigned int *)kshim_param_ring_bytes() = strtoul(optarg, NULL, 10);
+            break;
+        case 'v':
+            verbose = true;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-w writers] [-r readers] [-s seekers] [-i entry_readers] [-f followers]"
+                    " [-z resizers] [-t seconds] [-l line_len] [-c write_chunk] [-e ring_entries]"
+                    " [-b ring_bytes] [-v]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (nr_writers == 0 || nr_writers > MAX_WRITERS || line_len < MIN_LINE_LEN || line_len > 4096 ||
+        write_chunk > MAX_WRITE_CHUNK)
+    {
+        fprintf(stderr, "need 1 to %d writers, a line length of %d to 4096 and a write chunk of at most %d\n",
+                MAX_WRITERS, MIN_LINE_LEN, MAX_WRITE_CHUNK);
+        exit(EXIT_FAILURE);
+    }
+
+    if (kshim_init() != 0)
+    {
+        fprintf(stderr, "module init failed\n");
+        exit(EXIT_FAILURE);
+    }
+
+    count[ROLE_WRITER] = nr_writers;
+    count[ROLE_READER] = nr_readers;
+    count[ROLE_SEEKER] = nr_seekers;
+    count[ROLE_ENTRIES] = nr_entries;
+    count[ROLE_FOLLOWER] = nr_followers;
+    count[ROLE_RESIZER] = nr_resizers;
+    nr_workers = nr_writers + nr_readers + nr_seekers + nr_entries + nr_followers + nr_resizers;
+    workers = calloc(nr_workers, sizeof(*workers));
+    if (!workers)
+        exit(EXIT_FAILURE);
+
+    start_ns = ktime_get_ns();
+    i = 0;
+    for (enum role role = 0; role < ROLE_MAX; role++)
+    {
+        for (unsigned int id = 0; id < count[role]; id++, i++)
+        {
+            workers[i].role = role;
+            workers[i].id = id;
+            pthread_create(&workers[i].thread, NULL, thread_fn[role], &workers[i]);
+        }
+    }
+    for (unsigned int s = 0; s < seconds * 10 && !stop; s++)
+        usleep(100000);
+    stop = true;
+    for (i = 0; i < nr_workers; i++)
+        pthread_join(workers[i].thread, NULL);
+    elapsed_ns = ktime_get_ns() - start_ns;
+
+    printf("%-6s %8s %12s %12s %10s %10s\n", "role", "threads", "ops/s", "MB/s", "ns/op", "misses");
+    for (enum role role = 0; role < ROLE_MAX; role++)
+    {
+        uint64_t ops = 0, bytes = 0, misses = 0;
+
+        for (i = 0; i < nr_workers; i++)
+        {
+            if (workers[i].role == role)
+            {
+                ops += workers[i].ops;
+                bytes += workers[i].bytes;
+                misses += workers[i].misses;
+            }
+        }
+        if (count[role] == 0)
+            continue;
+        printf("%-6s %8u %12.0f %12.2f %10.1f %10llu\n", role_names[role], count[role],
+               ops * 1e9 / elapsed_ns, bytes * 1e3 / elapsed_ns,
+               ops ? (double)elapsed_ns * count[role] / ops : 0.0, (unsigned long long)misses);
+    }
+    if (verbose)
+    {
+        kshim_debugfs_show("aesdchar/aesdchar0/stats", stdout);
+        kshim_debugfs_show("aesdchar/aesdchar0/latency", stdout);
+    }
+
+    kshim_exit();
+    free(workers);
+    if (failed)
+    {
+        printf("FAILED\n");
+        return EXIT_FAILURE;
+    }
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * cb_bench.c
+ *
+ * Microbenchmarks of aesd-circular-buffer.c in user space: add_entry into a full ring,
+ * find_entry_offset_for_fpos at random positions and a sequential scan the way a reader
+ * walks the ring, for each ring size and entry size distribution.  Prints ns/op and,
+ * where perf_event_open is allowed, cache misses per op.
+ *
+ * The same adds and a walk over the live entries are then repeated on aesd-ring.h rings of
+ * fixed capacity, reported as add/t and walk/t, against aesd_circular_buffer at that capacity.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "aesd-circular-buffer.h"
+#include "aesd-ring.h"
+
+#define TABLE_SIZE (1u << 16)           /* Precomputed sizes and queries, a power of two */
+#define MAX_ENTRY_SIZE (1u << 16)
+
+enum counter { CNT_CACHE_MISSES, CNT_L1D_MISSES, CNT_MAX };
+
+struct dist {
+    const char *name;
+    size_t (*next)(uint64_t *rng);
+};
+
+static const char blob[MAX_ENTRY_SIZE];
+static int counter_fd[CNT_MAX];
+static volatile size_t sink;
+
+static uint64_t xorshift64(uint64_t *s)
+{
+    uint64_t x = *s;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *s = x;
+}
+
+static size_t dist_fixed(uint64_t *rng)
+{
+    (void)rng;
+    return 64;
+}
+
+static size_t dist_uniform(uint64_t *rng)
+{
+    return 1 + xorshift64(rng) % 4096;
+}
+
+/* Mostly short lines with an occasional large dump */
+static size_t dist_bimodal(uint64_t *rng)
+{
+    uint64_t r = xorshift64(rng);
+
+    if (r % 10 == 0)
+        return 4096 + (r >> 8) % (MAX_ENTRY_SIZE - 4096);
+    return 32 + (r >> 8) % 64;
+}
+
+static const struct dist dists[] = {
+    { "fixed64", dist_fixed },
+    { "uniform4k", dist_uniform },
+    { "bimodal", dist_bimodal },
+};
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int perf_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* A counter that cannot be opened (no PMU, perf_event_paranoid) is reported as "-" */
+static void counters_open(void)
+{
+    counter_fd[CNT_CACHE_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    counter_fd[CNT_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE,
+            PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+            (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+    if (counter_fd[CNT_CACHE_MISSES] < 0 && counter_fd[CNT_L1D_MISSES] < 0)
+        fprintf(stderr, "perf_event_open unavailable, cache misses not reported\n");
+}
+
+static void counters_start(void)
+{
+    for (int i = 0; i < CNT_MAX; i++)
+    {
+        if (counter_fd[i] >= 0)
+        {
+            ioctl(counter_fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter_fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+static void counters_stop(int64_t *values)
+{
+    for (int i = 0; i < CNT_MAX; i++)
+    {
+        uint64_t v;
+
+        values[i] = -1;
+        if (counter_fd[i] < 0)
+            continue;
+        ioctl(counter_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter_fd[i], &v, sizeof(v)) == sizeof(v))
+            values[i] = v;
+    }
+}
+
+struct measure {
+    uint64_t start_ns;
+    int64_t counts[CNT_MAX];
+};
+
+static void measure_begin(struct measure *m)
+{
+    counters_start();
+    m->start_ns = now_ns();
+}
+
+static void measure_end(struct measure *m, const char *op, uint32_t entries, const char *dist,
+            uint64_t ops)
+{
+    uint64_t ns = now_ns() - m->start_ns;
+
+    counters_stop(m->counts);
+    printf("%-6s %10u %-10s %10llu %10.2f", op, entries, dist, (unsigned long long)ops,
+           (double)ns / ops);
+    for (int i = 0; i < CNT_MAX; i++)
+    {
+        if (m->counts[i] < 0)
+            printf(" %14s", "-");
+        else
+            printf(" %14.3f", (double)m->counts[i] / ops);
+    }
+    printf("\n");
+}
+
+static void bench_one(uint32_t entries, const struct dist *dist, uint64_t min_ops)
+{
+    struct aesd_circular_buffer buffer;
+    struct aesd_buffer_entry *storage;
+    struct aesd_buffer_entry add = { .buffptr = blob };
+    struct aesd_buffer_entry *entry;
+    struct measure m;
+    size_t *sizes, *queries;
+    size_t size, off, pos, total;
+    uint64_t rng = 0x9e3779b97f4a7c15ull ^ entries;
+    uint64_t ops, i;
+
+    storage = malloc(sizeof(*storage) * entries);
+    sizes = malloc(sizeof(*sizes) * TABLE_SIZE);
+    queries = malloc(sizeof(*queries) * TABLE_SIZE);
+    if (!storage || !sizes || !queries)
+    {
+        fprintf(stderr, "out of memory for %u entries\n", entries);
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < TABLE_SIZE; i++)
+        sizes[i] = dist->next(&rng);
+
+    aesd_circular_buffer_init_storage(&buffer, storage, entries);
+    for (i = 0; i < entries; i++)
+    {
+        add.size = sizes[i & (TABLE_SIZE - 1)];
+        aesd_circular_buffer_add_entry(&buffer, &add);
+    }
+
+    /* Steady state: every add overwrites the oldest entry */
+    ops = entries > min_ops ? entries : min_ops;
+    measure_begin(&m);
+    for (i = 0; i < ops; i++)
+    {
+        add.size = sizes[i & (TABLE_SIZE - 1)];
+        aesd_circular_buffer_add_entry(&buffer, &add);
+    }
+    measure_end(&m, "add", entries, dist->name, ops);
+
+    size = aesd_circular_buffer_size(&buffer);
+    for (i = 0; i < TABLE_SIZE; i++)
+        queries[i] = xorshift64(&rng) % size;
+    total = 0;
+    measure_begin(&m);
+    for (i = 0; i < min_ops; i++)
+    {
+        entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, queries[i & (TABLE_SIZE - 1)], &off);
+        total += entry->size - off;
+    }
+    measure_end(&m, "find", entries, dist->name, min_ops);
+    sink = total;
+
+    /* Like a reader: look up the position, consume the rest of that entry, repeat */
+    ops = 0;
+    total = 0;
+    measure_begin(&m);
+    do
+    {
+        for (pos = 0; (entry = aesd_circular_buffer_find_entry_offset_for_fpos(&buffer, pos, &off)) != NULL; ops++)
+        {
+            total += entry->buffptr[off];
+            pos += entry->size - off;
+        }
+    } while (ops < min_ops);
+    measure_end(&m, "scan", entries, dist->name, ops);
+    sink = total;
+
+    free(queries);
+    free(sizes);
+    free(storage);
+}
+
+/* Typed rings at the driver's default capacity and at a power of two */
+AESD_RING_DEFINE(entry_ring10, struct aesd_buffer_entry, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED)
+AESD_RING_DEFINE(entry_ring1024, struct aesd_buffer_entry, 1024)
+
+/*
+ * add/walk on aesd_circular_buffer, then add/t and walk/t on the typed ring_type, both
+ * holding capacity entries
+ */
+#define BENCH_TYPED(ring_type, capacity, dist, min_ops)                                         \
+do                                                                                              \
+{                                                                                               \
+    static struct ring_type ring;                                                               \
+    static struct aesd_buffer_entry storage[capacity];                                          \
+    struct aesd_circular_buffer buffer;                                                         \
+    struct aesd_buffer_entry add = { .buffptr = blob };                                         \
+    struct aesd_buffer_entry *entry;                                                            \
+    struct measure m;                                                                           \
+    uint64_t rng = 0x9e3779b97f4a7c15ull ^ (capacity);                                          \
+    uint64_t ops, i;                                                                            \
+    uint32_t n;                                                                                 \
+    size_t total;                                                                               \
+                                                                                                \
+    aesd_circular_buffer_init_storage(&buffer, storage, capacity);                              \
+    measure_begin(&m);                                                                          \
+    for (i = 0; i < (min_ops); i++)                                                             \
+    {                                                                                           \
+        add.size = (dist)->next(&rng);                                                          \
+        aesd_circular_buffer_add_entry(&buffer, &add);                                          \
+    }                                                                                           \
+    measure_end(&m, "add", capacity, (dist)->name, (min_ops));                                  \
+                                                                                                \
+    ring_type##_init(&ring);                                                                    \
+    rng = 0x9e3779b97f4a7c15ull ^ (capacity);                                                   \
+    measure_begin(&m);                                                                          \
+    for (i = 0; i < (min_ops); i++)                                                             \
+    {                                                                                           \
+        entry = ring_type##_push_slot(&ring);                                                   \
+        entry->buffptr = blob;                                                                  \
+        entry->size = (dist)->next(&rng);                                                       \
+    }                                                                                           \
+    measure_end(&m, "add/t", capacity, (dist)->name, (min_ops));                                \
+                                                                                                \
+    ops = 0;                                                                                    \
+    total = 0;                                                                                  \
+    measure_begin(&m);                                                                          \
+    do                                                                                          \
+    {                                                                                           \
+        AESD_CIRCULAR_BUFFER_FOREACH_LIVE(entry, &buffer, n)                                    \
+            total += entry->size;                                                               \
+        ops += n;                                                                               \
+    } while (ops < (min_ops));                                                                  \
+    measure_end(&m, "walk", capacity, (dist)->name, ops);                                       \
+                                                                                                \
+    ops = 0;                                                                                    \
+    measure_begin(&m);                                                                          \
+    do                                                                                          \
+    {                                                                                           \
+        AESD_RING_FOREACH(ring_type, &ring, n, entry)                                           \
+            total += entry->size;                                                               \
+        ops += n;                                                                               \
+    } while (ops < (min_ops));                                                                  \
+    measure_end(&m, "walk/t", capacity, (dist)->name, ops);                                     \
+    sink = total;                                                                               \
+} while (0)
+
+/* Parse a comma separated list of up to max numbers into values, returning how many */
+static size_t parse_list(const char *arg, uint32_t *values, size_t max)
+{
+    size_t n = 0;
+    char *end;
+
+    while (*arg && n < max)
+    {
+        unsigned long v = strtoul(arg, &end, 0);
+        if (end == arg || v == 0 || v > UINT32_MAX)
+        {
+            fprintf(stderr, "bad entry count list\n");
+            exit(EXIT_FAILURE);
+        }
+        values[n++] = v;
+        arg = *end == ',' ? end + 1 : end;
+    }
+    return n;
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t entries[16] = { 10, 1000, 65536, 1000000, 4194304 };
+    size_t nentries = 5;
+    const char *dist_name = NULL;
+    uint64_t min_ops = 1 << 20;
+    bool matched = false;
+    int opt_char;
+
+    // -e <n,...>: ring sizes, -d <name>: one entry size distribution, -n <ops>: minimum ops per measurement
+    while ((opt_char = getopt(argc, argv, "e:d:n:")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'e':
+            nentries = parse_list(optarg, entries, sizeof(entries) / sizeof(entries[0]));
+            break;
+        case 'd':
+            dist_name = optarg;
+            break;
+        case 'n':
+            min_ops = strtoull(optarg, NULL, 0);
+            if (min_ops == 0)
+                min_ops = 1;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-e entries,...] [-d fixed64|uniform4k|bimodal] [-n ops]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    counters_open();
+    printf("%-6s %10s %-10s %10s %10s %14s %14s\n", "op", "entries", "sizes", "ops", "ns/op",
+           "cache-miss/op", "l1d-miss/op");
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++)
+    {
+        if (dist_name && strcmp(dist_name, dists[d].name))
+            continue;
+        matched = true;
+        for (size_t e = 0; e < nentries; e++)
+            bench_one(entries[e], &dists[d], min_ops);
+        BENCH_TYPED(entry_ring10, AESDCHAR_MAX_WRITE_OPERATIONS_SUPPORTED, &dists[d], min_ops);
+        BENCH_TYPED(entry_ring1024, 1024, &dists[d], min_ops);
+    }
+    if (!matched)
+    {
+        fprintf(stderr, "unknown distribution %s\n", dist_name);
+        exit(EXIT_FAILURE);
+    }
+    return 0;
+}
@@ -0,0 +1 @@
+/* Tracepoints are defined by kshim.h, nothing to generate */
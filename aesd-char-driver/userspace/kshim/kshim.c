@@ -0,0 +1,256 @@
+/*
+ * kshim.c
+ *
+ * Out of line parts of the user space kernel shim: iov_iter copies, the debugfs registry
+ * and the VFS-like entry points a harness calls.
+ *
+ */
+
+#include "kshim.h"
+
+/*
+ * Copy between @param p and the iterator, toward the iterator when @param to_iter is set
+ */
+static size_t kshim_iter_copy(struct iov_iter *i, char *p, size_t bytes, bool to_iter)
+{
+    size_t done = 0;
+
+    if (bytes > i->count)
+        bytes = i->count;
+    while (done < bytes) {
+        char *base = (char *)i->iov->iov_base + i->iov_offset;
+        size_t n = i->iov->iov_len - i->iov_offset;
+
+        if (n > bytes - done)
+            n = bytes - done;
+        if (to_iter)
+            memcpy(base, p + done, n);
+        else
+            memcpy(p + done, base, n);
+        done += n;
+        i->iov_offset += n;
+        if (i->iov_offset == i->iov->iov_len) {
+            i->iov++;
+            i->nr_segs--;
+            i->iov_offset = 0;
+        }
+    }
+    i->count -= done;
+    return done;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i)
+{
+    return kshim_iter_copy(i, (char *)addr, bytes, true);
+}
+
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i)
+{
+    return kshim_iter_copy(i, addr, bytes, false);
+}
+
+void iov_iter_revert(struct iov_iter *i, size_t bytes)
+{
+    i->count += bytes;
+    while (bytes) {
+        size_t n;
+
+        if (i->iov_offset == 0) {
+            i->iov--;
+            i->nr_segs++;
+            i->iov_offset = i->iov->iov_len;
+        }
+        n = min(i->iov_offset, bytes);
+        i->iov_offset -= n;
+        bytes -= n;
+    }
+}
+
+/*
+ * debugfs: every directory and file is a dentry on one list
+ */
+struct dentry {
+    struct dentry *next;
+    struct dentry *parent;
+    char name[64];
+    void *data;
+    const struct file_operations *fops;     /* NULL for a directory */
+};
+
+static pthread_mutex_t debugfs_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dentry *debugfs_list;
+
+static struct dentry *debugfs_add(const char *name, struct dentry *parent, void *data,
+            const struct file_operations *fops)
+{
+    struct dentry *d = calloc(1, sizeof(*d));
+
+    if (!d)
+        return ERR_PTR(-ENOMEM);
+    snprintf(d->name, sizeof(d->name), "%s", name);
+    d->parent = parent;
+    d->data = data;
+    d->fops = fops;
+    pthread_mutex_lock(&debugfs_lock);
+    d->next = debugfs_list;
+    debugfs_list = d;
+    pthread_mutex_unlock(&debugfs_lock);
+    return d;
+}
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent)
+{
+    return debugfs_add(name, parent, NULL, NULL);
+}
+
+struct dentry *debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+            const struct file_operations *fops)
+{
+    return debugfs_add(name, parent, data, fops);
+}
+
+static bool debugfs_is_under(const struct dentry *d, const struct dentry *ancestor)
+{
+    for (; d; d = d->parent) {
+        if (d == ancestor)
+            return true;
+    }
+    return false;
+}
+
+void debugfs_remove_recursive(struct dentry *dentry)
+{
+    struct dentry **link, *d, *doomed = NULL;
+
+    if (!dentry || IS_ERR(dentry))
+        return;
+
+    /* Unlink everything first: ancestors must stay valid while the chains are walked */
+    pthread_mutex_lock(&debugfs_lock);
+    link = &debugfs_list;
+    while ((d = *link) != NULL) {
+        if (debugfs_is_under(d, dentry)) {
+            *link = d->next;
+            d->next = doomed;
+            doomed = d;
+        } else {
+            link = &d->next;
+        }
+    }
+    pthread_mutex_unlock(&debugfs_lock);
+
+    while ((d = doomed) != NULL) {
+        doomed = d->next;
+        free(d);
+    }
+}
+
+/*
+ * @return whether @param path names @param d, comparing from the last component up
+ */
+static bool debugfs_path_matches(const struct dentry *d, const char *path, size_t len)
+{
+    for (; d; d = d->parent) {
+        size_t n = strlen(d->name);
+
+        if (n > len || memcmp(path + len - n, d->name, n) != 0)
+            return false;
+        len -= n;
+        if (len == 0)
+            return d->parent == NULL;
+        if (path[--len] != '/')
+            return false;
+    }
+    return false;
+}
+
+int kshim_debugfs_show(const char *path, FILE *out)
+{
+    struct seq_file m = { .out = out };
+    const struct dentry *d;
+    int ret = -ENOENT;
+
+    pthread_mutex_lock(&debugfs_lock);
+    for (d = debugfs_list; d; d = d->next) {
+        if (d->fops && debugfs_path_matches(d, path, strlen(path))) {
+            m.private = d->data;
+            ret = d->fops->show(&m, NULL);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&debugfs_lock);
+    return ret;
+}
+
+/*
+ * VFS-like entry points.  Each open file gets its own inode, freed on release.
+ */
+
+int kshim_open(const struct file_operations *fops, struct cdev *cdev, struct file *filp)
+{
+    struct inode *inode = calloc(1, sizeof(*inode));
+    int ret;
+
+    if (!inode)
+        return -ENOMEM;
+    inode->i_cdev = cdev;
+    memset(filp, 0, sizeof(*filp));
+    filp->f_inode = inode;
+    filp->f_mode = 3;                       /* FMODE_READ | FMODE_WRITE */
+    ret = fops->open(inode, filp);
+    if (ret)
+        free(inode);
+    return ret;
+}
+
+int kshim_release(const struct file_operations *fops, struct file *filp)
+{
+    int ret = fops->release(filp->f_inode, filp);
+
+    free(filp->f_inode);
+    filp->f_inode = NULL;
+    return ret;
+}
+
+static ssize_t kshim_rw(const struct file_operations *fops, struct file *filp, const struct iovec *iov,
+            unsigned long nr_segs, loff_t *pos, bool write)
+{
+    struct kiocb iocb = { .ki_filp = filp, .ki_pos = *pos };
+    struct iov_iter iter = { .iov = iov, .nr_segs = nr_segs };
+    unsigned long seg;
+    ssize_t ret;
+
+    for (seg = 0; seg < nr_segs; seg++)
+        iter.count += iov[seg].iov_len;
+    ret = write ? fops->write_iter(&iocb, &iter) : fops->read_iter(&iocb, &iter);
+    *pos = iocb.ki_pos;
+    return ret;
+}
+
+ssize_t kshim_readv(const struct file_operations *fops, struct file *filp, const struct iovec *iov,
+            unsigned long nr_segs, loff_t *pos)
+{
+    return kshim_rw(fops, filp, iov, nr_segs, pos, false);
+}
+
+ssize_t kshim_writev(const struct file_operations *fops, struct file *filp, const struct iovec *iov,
+            unsigned long nr_segs, loff_t *pos)
+{
+    return kshim_rw(fops, filp, iov, nr_segs, pos, true);
+}
+
+ssize_t kshim_read(const struct file_operations *fops, struct file *filp, void *buf, size_t count,
+            loff_t *pos)
+{
+    struct iovec iov = { .iov_base = buf, .iov_len = count };
+
+    return kshim_rw(fops, filp, &iov, 1, pos, false);
+}
+
+ssize_t kshim_write(const struct file_operations *fops, struct file *filp, const void *buf, size_t count,
+            loff_t *pos)
+{
+    struct iovec iov = { .iov_base = (void *)buf, .iov_len = count };
+
+    return kshim_rw(fops, filp, &iov, 1, pos, true);
+}
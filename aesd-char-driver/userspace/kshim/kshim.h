@@ -0,0 +1,651 @@
+/*
+ * kshim.h
+ *
+ *  @brief Just enough of the kernel API for the aesdchar driver sources to build and run as a
+ *  user space program, see aesdchar_stress.c
+ *
+ * Every <linux/...> header under include/ forwards here.  Locks, SRCU, seqcounts and wait
+ * queues are real, built on pthreads and compiler atomics, so concurrent callers of the driver
+ * exercise its synchronization.  "User" pointers are plain pointers, per-CPU data is a single
+ * shared copy updated atomically, and tracepoints, cdevs and NUMA placement do nothing.
+ */
+
+#ifndef KSHIM_H
+#define KSHIM_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#ifndef __KERNEL__
+#define __KERNEL__ 1
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <sched.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/* Types, compiler and printk */
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef long long s64;
+typedef unsigned int gfp_t;
+typedef unsigned int fmode_t;
+typedef unsigned int __poll_t;
+
+#define __user
+#define __rcu
+#define __percpu
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_mb() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define container_of(ptr, type, member) ((type *)((char *)(ptr) - offsetof(type, member)))
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+#define min_t(t, a, b) ((t)(a) < (t)(b) ? (t)(a) : (t)(b))
+#define max_t(t, a, b) ((t)(a) > (t)(b) ? (t)(a) : (t)(b))
+#define swap(a, b) do { __typeof__(a) __tmp = (a); (a) = (b); (b) = __tmp; } while (0)
+#define ALIGN(x, a) (((x) + ((a) - 1)) & ~((__typeof__(x))(a) - 1))
+
+#define ERESTARTSYS 512
+#define ERR_PTR(err) ((void *)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+#define IS_ERR(ptr) ((unsigned long)(ptr) >= (unsigned long)-4095)
+
+#define KERN_ERR ""
+#define KERN_WARNING ""
+#define KERN_INFO ""
+#define KERN_DEBUG ""
+#define printk(...) fprintf(stderr, __VA_ARGS__)
+#define pr_warn(...) fprintf(stderr, __VA_ARGS__)
+#define pr_info(...) fprintf(stderr, __VA_ARGS__)
+#define pr_debug(...) ((void)0)
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#define LINUX_VERSION_CODE KERNEL_VERSION(6, 1, 0)
+
+static inline int ilog2(unsigned long long n)
+{
+    return 63 - __builtin_clzll(n);
+}
+
+static inline unsigned long roundup_pow_of_two(unsigned long n)
+{
+    unsigned long r = 1;
+
+    while (r < n)
+        r <<= 1;
+    return r;
+}
+
+static inline size_t array_size(size_t a, size_t b)
+{
+    return b && a > SIZE_MAX / b ? SIZE_MAX : a * b;
+}
+
+static inline u64 ktime_get_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline u64 ktime_get_real_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (u64)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* Modules: module_init()/module_exit() become kshim_init()/kshim_exit(), and each parameter
+ * gets a kshim_param_<name>() returning its address so a harness can set it before init */
+
+struct module;
+#define THIS_MODULE ((struct module *)0)
+#define MODULE_AUTHOR(x)
+#define MODULE_LICENSE(x)
+#define MODULE_PARM_DESC(name, desc)
+#define module_param(name, type, perm) \
+    void *kshim_param_##name(void) { return &name; }
+#define module_init(fn) \
+    int kshim_init(void) { return fn(); }
+#define module_exit(fn) \
+    void kshim_exit(void) { fn(); }
+
+int kshim_init(void);
+void kshim_exit(void);
+
+/* Memory: the heap, NUMA nodes ignored */
+
+#define GFP_KERNEL 0u
+#define __GFP_ZERO 1u
+#define NUMA_NO_NODE (-1)
+#define PAGE_SIZE 4096UL
+#define PAGE_ALIGN(x) ALIGN(x, PAGE_SIZE)
+
+static inline void *kmalloc(size_t n, gfp_t flags)
+{
+    return (flags & __GFP_ZERO) ? calloc(1, n) : malloc(n);
+}
+
+static inline void *kzalloc(size_t n, gfp_t flags)
+{
+    return calloc(1, n);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+    return calloc(n, size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+    return array_size(n, size) == SIZE_MAX ? NULL : malloc(n * size);
+}
+
+static inline void *krealloc(const void *p, size_t n, gfp_t flags)
+{
+    return realloc((void *)p, n);
+}
+
+static inline void kfree(const void *p)
+{
+    free((void *)p);
+}
+
+static inline void *kzalloc_node(size_t n, gfp_t flags, int node)
+{
+    return calloc(1, n);
+}
+
+#define kvmalloc(n, flags) kmalloc(n, flags)
+#define kvmalloc_node(n, flags, node) kmalloc(n, flags)
+#define kvcalloc(n, size, flags) kcalloc(n, size, flags)
+#define kvfree(p) kfree(p)
+#define vmalloc(n) malloc(n)
+#define vmalloc_node(n, node) malloc(n)
+#define vfree(p) kfree(p)
+
+static inline void *vmalloc_user(unsigned long size)
+{
+    void *p = aligned_alloc(PAGE_SIZE, PAGE_ALIGN(size));
+
+    if (p)
+        memset(p, 0, PAGE_ALIGN(size));
+    return p;
+}
+
+static inline int num_online_nodes(void)
+{
+    return 1;
+}
+
+#define for_each_online_node(node) for ((node) = 0; (node) < 1; (node)++)
+
+/* User memory is the caller's memory */
+
+#define u64_to_user_ptr(x) ((void *)(uintptr_t)(x))
+
+static inline unsigned long copy_to_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+static inline unsigned long copy_from_user(void *to, const void *from, unsigned long n)
+{
+    memcpy(to, from, n);
+    return 0;
+}
+
+/* Per-CPU data: one copy shared by every thread */
+
+#define alloc_percpu(type) ((type *)calloc(1, sizeof(type)))
+#define free_percpu(p) free(p)
+#define per_cpu_ptr(p, cpu) ((void)(cpu), (p))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; (cpu)++)
+#define this_cpu_add(x, n) ((void)__atomic_add_fetch(&(x), (n), __ATOMIC_RELAXED))
+#define this_cpu_inc(x) this_cpu_add(x, 1)
+
+/* Locking */
+
+struct mutex {
+    pthread_mutex_t m;
+};
+
+static inline void mutex_init(struct mutex *lock)
+{
+    pthread_mutex_init(&lock->m, NULL);
+}
+
+static inline void mutex_lock(struct mutex *lock)
+{
+    pthread_mutex_lock(&lock->m);
+}
+
+/* Signals never interrupt the wait */
+static inline int mutex_lock_interruptible(struct mutex *lock)
+{
+    return pthread_mutex_lock(&lock->m);
+}
+
+static inline int mutex_trylock(struct mutex *lock)
+{
+    return pthread_mutex_trylock(&lock->m) == 0;
+}
+
+static inline void mutex_unlock(struct mutex *lock)
+{
+    pthread_mutex_unlock(&lock->m);
+}
+
+#define lockdep_is_held(lock) 1
+
+typedef struct {
+    unsigned int sequence;
+} seqcount_mutex_t;
+
+#define seqcount_mutex_init(s, lock) ((s)->sequence = 0)
+
+static inline unsigned int read_seqcount_begin(const seqcount_mutex_t *s)
+{
+    unsigned int seq;
+
+    while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 1)
+        sched_yield();
+    return seq;
+}
+
+static inline int read_seqcount_retry(const seqcount_mutex_t *s, unsigned int start)
+{
+    smp_rmb();
+    return __atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline void write_seqcount_begin(seqcount_mutex_t *s)
+{
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+    smp_wmb();
+}
+
+static inline void write_seqcount_end(seqcount_mutex_t *s)
+{
+    smp_wmb();
+    __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+}
+
+/* RCU and SRCU: SRCU counts its readers and runs callbacks once none is left; RCU is only
+ * used here for objects no reader can still reach, so its callbacks run at once */
+
+struct rcu_head {
+    struct rcu_head *next;
+    void (*func)(struct rcu_head *head);
+};
+
+typedef void (*rcu_callback_t)(struct rcu_head *head);
+
+#define rcu_read_lock() ((void)0)
+#define rcu_read_unlock() ((void)0)
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define rcu_dereference_protected(p, c) (p)
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define RCU_INIT_POINTER(p, v) ((p) = (v))
+
+static inline void call_rcu(struct rcu_head *head, rcu_callback_t func)
+{
+    func(head);
+}
+
+static inline void rcu_barrier(void)
+{
+}
+
+struct srcu_struct {
+    pthread_mutex_t m;
+    struct rcu_head *pending;
+    int readers;
+};
+
+static inline int init_srcu_struct(struct srcu_struct *s)
+{
+    pthread_mutex_init(&s->m, NULL);
+    s->pending = NULL;
+    s->readers = 0;
+    return 0;
+}
+
+static inline int srcu_read_lock(struct srcu_struct *s)
+{
+    __atomic_add_fetch(&s->readers, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+static inline void srcu_read_unlock(struct srcu_struct *s, int idx)
+{
+    __atomic_sub_fetch(&s->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline void call_srcu(struct srcu_struct *s, struct rcu_head *head, rcu_callback_t func)
+{
+    pthread_mutex_lock(&s->m);
+    head->func = func;
+    head->next = s->pending;
+    s->pending = head;
+    pthread_mutex_unlock(&s->m);
+}
+
+static inline void synchronize_srcu(struct srcu_struct *s)
+{
+    struct rcu_head *head, *next;
+
+    pthread_mutex_lock(&s->m);
+    head = s->pending;
+    s->pending = NULL;
+    pthread_mutex_unlock(&s->m);
+
+    while (__atomic_load_n(&s->readers, __ATOMIC_SEQ_CST))
+        sched_yield();
+    for (; head; head = next) {
+        next = head->next;
+        head->func(head);
+    }
+}
+
+#define srcu_barrier(s) synchronize_srcu(s)
+#define cleanup_srcu_struct(s) synchronize_srcu(s)
+
+struct kref {
+    int refcount;
+};
+
+static inline void kref_init(struct kref *k)
+{
+    k->refcount = 1;
+}
+
+static inline void kref_get(struct kref *k)
+{
+    __atomic_add_fetch(&k->refcount, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int kref_get_unless_zero(struct kref *k)
+{
+    int v = __atomic_load_n(&k->refcount, __ATOMIC_SEQ_CST);
+
+    while (v) {
+        if (__atomic_compare_exchange_n(&k->refcount, &v, v + 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            return 1;
+    }
+    return 0;
+}
+
+static inline int kref_put(struct kref *k, void (*release)(struct kref *k))
+{
+    if (__atomic_sub_fetch(&k->refcount, 1, __ATOMIC_SEQ_CST) == 0) {
+        release(k);
+        return 1;
+    }
+    return 0;
+}
+
+/* Wait queues: a waiter re-checks its condition every millisecond, so a wakeup racing with
+ * the check only costs latency */
+
+typedef struct {
+    pthread_mutex_t m;
+    pthread_cond_t c;
+} wait_queue_head_t;
+
+static inline void init_waitqueue_head(wait_queue_head_t *q)
+{
+    pthread_mutex_init(&q->m, NULL);
+    pthread_cond_init(&q->c, NULL);
+}
+
+static inline void wake_up_interruptible_poll(wait_queue_head_t *q, int key)
+{
+    pthread_mutex_lock(&q->m);
+    pthread_cond_broadcast(&q->c);
+    pthread_mutex_unlock(&q->m);
+}
+
+#define wake_up_interruptible(q) wake_up_interruptible_poll(q, 0)
+
+static inline void kshim_wait_tick(wait_queue_head_t *q)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&q->c, &q->m, &ts);
+}
+
+#define wait_event_interruptible(q, cond) ({          \
+    pthread_mutex_lock(&(q).m);                         \
+    while (!(cond))                                     \
+        kshim_wait_tick(&(q));                          \
+    pthread_mutex_unlock(&(q).m);                       \
+    0;                                                  \
+})
+
+#define EPOLLIN POLLIN
+#define EPOLLRDNORM POLLRDNORM
+#define EPOLLOUT POLLOUT
+#define EPOLLWRNORM POLLWRNORM
+
+typedef struct poll_table_struct {
+    int unused;
+} poll_table;
+
+struct file;
+
+static inline void poll_wait(struct file *filp, wait_queue_head_t *q, poll_table *p)
+{
+}
+
+/* Files and char devices */
+
+#define MINORBITS 20
+#define MKDEV(ma, mi) (((ma) << MINORBITS) | (mi))
+#define MAJOR(dev) ((unsigned int)((dev) >> MINORBITS))
+#define MINOR(dev) ((unsigned int)((dev) & ((1U << MINORBITS) - 1)))
+
+struct inode;
+struct kiocb;
+struct iov_iter;
+struct seq_file;
+struct vm_area_struct;
+struct pipe_inode_info;
+
+struct file_operations {
+    struct module *owner;
+    ssize_t (*read_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*write_iter)(struct kiocb *, struct iov_iter *);
+    ssize_t (*splice_read)(struct file *, loff_t *, struct pipe_inode_info *, size_t, unsigned int);
+    ssize_t (*splice_write)(struct pipe_inode_info *, struct file *, loff_t *, size_t, unsigned int);
+    int (*open)(struct inode *, struct file *);
+    int (*release)(struct inode *, struct file *);
+    int (*mmap)(struct file *, struct vm_area_struct *);
+    __poll_t (*poll)(struct file *, struct poll_table_struct *);
+    loff_t (*llseek)(struct file *, loff_t, int);
+    long (*unlocked_ioctl)(struct file *, unsigned int, unsigned long);
+    int (*show)(struct seq_file *, void *);     /* Shim only, set by DEFINE_SHOW_ATTRIBUTE */
+};
+
+struct cdev {
+    dev_t dev;
+    struct module *owner;
+    const struct file_operations *ops;
+};
+
+struct inode {
+    struct cdev *i_cdev;
+};
+
+struct file {
+    loff_t f_pos;
+    unsigned int f_flags;
+    fmode_t f_mode;
+    struct inode *f_inode;
+    void *private_data;
+};
+
+static inline void cdev_init(struct cdev *cdev, const struct file_operations *fops)
+{
+    cdev->ops = fops;
+}
+
+static inline int cdev_add(struct cdev *cdev, dev_t dev, unsigned int count)
+{
+    cdev->dev = dev;
+    return 0;
+}
+
+static inline void cdev_del(struct cdev *cdev)
+{
+}
+
+static inline int alloc_chrdev_region(dev_t *dev, unsigned int baseminor, unsigned int count,
+            const char *name)
+{
+    *dev = MKDEV(240, baseminor);
+    return 0;
+}
+
+static inline void unregister_chrdev_region(dev_t dev, unsigned int count)
+{
+}
+
+/* Vectored I/O: an iov_iter walks the caller's iovec array */
+
+#define IOCB_NOWAIT 0x8
+
+struct kiocb {
+    struct file *ki_filp;
+    loff_t ki_pos;
+    int ki_flags;
+};
+
+struct iov_iter {
+    const struct iovec *iov;
+    unsigned long nr_segs;
+    size_t iov_offset;                  /* Into iov[0] */
+    size_t count;                       /* Bytes left */
+};
+
+static inline size_t iov_iter_count(const struct iov_iter *i)
+{
+    return i->count;
+}
+
+size_t copy_to_iter(const void *addr, size_t bytes, struct iov_iter *i);
+size_t copy_from_iter(void *addr, size_t bytes, struct iov_iter *i);
+void iov_iter_revert(struct iov_iter *i, size_t bytes);
+
+static inline ssize_t generic_file_splice_read(struct file *in, loff_t *ppos, struct pipe_inode_info *pipe,
+            size_t len, unsigned int flags)
+{
+    return -EINVAL;
+}
+
+static inline ssize_t iter_file_splice_write(struct pipe_inode_info *pipe, struct file *out, loff_t *ppos,
+            size_t len, unsigned int flags)
+{
+    return -EINVAL;
+}
+
+/* mmap: the shim "maps" an area by pointing vm_start at it */
+
+#define VM_WRITE 0x2UL
+#define VM_MAYWRITE 0x20UL
+
+struct vm_operations_struct {
+    void (*open)(struct vm_area_struct *vma);
+    void (*close)(struct vm_area_struct *vma);
+};
+
+struct vm_area_struct {
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_pgoff;
+    unsigned long vm_flags;
+    void *vm_private_data;
+    const struct vm_operations_struct *vm_ops;
+};
+
+static inline int remap_vmalloc_range(struct vm_area_struct *vma, void *addr, unsigned long pgoff)
+{
+    vma->vm_end = (unsigned long)addr + (vma->vm_end - vma->vm_start);
+    vma->vm_start = (unsigned long)addr;
+    return 0;
+}
+
+/* debugfs and seq_file: files are recorded so a harness can print them, see kshim_debugfs_show() */
+
+struct dentry;
+
+struct seq_file {
+    void *private;
+    FILE *out;
+};
+
+#define seq_printf(m, ...) fprintf((m)->out, __VA_ARGS__)
+#define DEFINE_SHOW_ATTRIBUTE(name) \
+    static const struct file_operations name##_fops = { .show = name##_show }
+
+struct dentry *debugfs_create_dir(const char *name, struct dentry *parent);
+struct dentry *debugfs_create_file(const char *name, unsigned int mode, struct dentry *parent, void *data,
+            const struct file_operations *fops);
+void debugfs_remove_recursive(struct dentry *dentry);
+
+/* Tracepoints compile to empty functions, still type checking their arguments, and are never enabled */
+
+#define TP_PROTO(args...) args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+    static inline void trace_##name(proto) {} \
+    static inline bool trace_##name##_enabled(void) { return false; }
+
+/* Harness side: drive a file_operations the way the VFS would */
+
+int kshim_open(const struct file_operations *fops, struct cdev *cdev, struct file *filp);
+int kshim_release(const struct file_operations *fops, struct file *filp);
+ssize_t kshim_readv(const struct file_operations *fops, struct file *filp, const struct iovec *iov,
+            unsigned long nr_segs, loff_t *pos);
+ssize_t kshim_writev(const struct file_operations *fops, struct file *filp, const struct iovec *iov,
+            unsigned long nr_segs, loff_t *pos);
+ssize_t kshim_read(const struct file_operations *fops, struct file *filp, void *buf, size_t count,
+            loff_t *pos);
+ssize_t kshim_write(const struct file_operations *fops, struct file *filp, const void *buf, size_t count,
+            loff_t *pos);
+
+/**
+ * Print debugfs file @param path, relative to the debugfs root, to @param out
+ * @return 0, or -ENOENT if there is no such file
+ */
+int kshim_debugfs_show(const char *path, FILE *out);
+
+#endif /* KSHIM_H */
@@ -0,0 +1,247 @@
+/*
+ * mpsc_bench.c
+ *
+ * Contention benchmark of aesd-mpsc-ring.c against the same bounded ring behind a pthread
+ * mutex: P producer threads push N items each while one consumer pops in batches, the way
+ * aesdsocket workers hand requests to the write scheduler's committer.  Prints the handoff
+ * rate and how often producers found the ring full, and checks each producer's items arrive
+ * in order.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "aesd-mpsc-ring.h"
+
+#define MAX_PRODUCERS 64
+#define BATCH 64
+
+/* Items encode their producer in the top byte and a per-producer count below it */
+#define ITEM(p, i) ((void *)(uintptr_t)(((uint64_t)(p) << 56) | ((i) + 1)))
+#define ITEM_PRODUCER(v) ((unsigned int)((uintptr_t)(v) >> 56))
+#define ITEM_COUNT(v) (((uintptr_t)(v) & ((1ULL << 56) - 1)) - 1)
+
+/* The mutex version: a plain bounded ring of pointers */
+struct locked_ring {
+    pthread_mutex_t lock;
+    void **item;
+    size_t mask;
+    size_t head;
+    size_t tail;
+};
+
+struct queue_ops {
+    const char *name;
+    bool (*push)(void *q, void *item);
+    size_t (*pop_batch)(void *q, void **items, size_t max);
+};
+
+struct run {
+    const struct queue_ops *ops;
+    void *queue;
+    uint64_t per_producer;
+    atomic_uint_fast64_t full_retries;
+    atomic_bool go;
+};
+
+static bool locked_push(void *q, void *item)
+{
+    struct locked_ring *r = q;
+    bool ok;
+
+    pthread_mutex_lock(&r->lock);
+    ok = r->tail - r->head <= r->mask;
+    if (ok)
+        r->item[r->tail++ & r->mask] = item;
+    pthread_mutex_unlock(&r->lock);
+    return ok;
+}
+
+static size_t locked_pop_batch(void *q, void **items, size_t max)
+{
+    struct locked_ring *r = q;
+    size_t n = 0;
+
+    pthread_mutex_lock(&r->lock);
+    while (n < max && r->head != r->tail)
+        items[n++] = r->item[r->head++ & r->mask];
+    pthread_mutex_unlock(&r->lock);
+    return n;
+}
+
+static bool mpsc_push(void *q, void *item)
+{
+    return aesd_mpsc_ring_push(q, item);
+}
+
+static size_t mpsc_pop_batch(void *q, void **items, size_t max)
+{
+    return aesd_mpsc_ring_pop_batch(q, items, max);
+}
+
+static const struct queue_ops queues[] = {
+    { "mutex", locked_push, locked_pop_batch },
+    { "mpsc", mpsc_push, mpsc_pop_batch },
+};
+
+struct producer {
+    pthread_t thread;
+    struct run *run;
+    unsigned int id;
+};
+
+static void *producer_thread(void *arg)
+{
+    struct producer *p = arg;
+    struct run *run = p->run;
+    uint64_t retries = 0;
+
+    while (!atomic_load(&run->go))
+        sched_yield();
+    for (uint64_t i = 0; i < run->per_producer; i++)
+    {
+        while (!run->ops->push(run->queue, ITEM(p->id, i)))
+        {
+            retries++;
+            sched_yield();
+        }
+    }
+    atomic_fetch_add(&run->full_retries, retries);
+    return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * One measurement: the calling thread is the consumer
+ * @return false if an item arrived out of order
+ */
+static bool bench_one(const struct queue_ops *ops, void *queue, unsigned int producers, uint64_t per_producer)
+{
+    struct producer prod[MAX_PRODUCERS];
+    uint64_t next[MAX_PRODUCERS] = { 0 };
+    struct run run = { .ops = ops, .queue = queue, .per_producer = per_producer };
+    void *batch[BATCH];
+    uint64_t total = per_producer * producers, got = 0, batches = 0, start, ns;
+    bool ordered = true;
+    size_t n;
+
+    for (unsigned int i = 0; i < producers; i++)
+    {
+        prod[i].run = &run;
+        prod[i].id = i;
+        pthread_create(&prod[i].thread, NULL, producer_thread, &prod[i]);
+    }
+
+    start = now_ns();
+    atomic_store(&run.go, true);
+    while (got < total)
+    {
+        n = ops->pop_batch(queue, batch, BATCH);
+        if (n == 0)
+        {
+            sched_yield();
+            continue;
+        }
+        batches++;
+        for (size_t i = 0; i < n; i++)
+        {
+            unsigned int p = ITEM_PRODUCER(batch[i]);
+
+            if (p >= producers || ITEM_COUNT(batch[i]) != next[p]++)
+                ordered = false;
+        }
+        got += n;
+    }
+    ns = now_ns() - start;
+
+    for (unsigned int i = 0; i < producers; i++)
+        pthread_join(prod[i].thread, NULL);
+
+    printf("%-6s %9u %12llu %12.2f %10.2f %10.1f %12llu%s\n", ops->name, producers,
+           (unsigned long long)total, total * 1e3 / ns, (double)ns / total,
+           (double)total / batches, (unsigned long long)atomic_load(&run.full_retries),
+           ordered ? "" : "  OUT OF ORDER");
+    return ordered;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int producer_counts[] = { 1, 2, 4, 8, 16 };
+    unsigned int max_producers = 16;
+    uint64_t per_producer = 1 << 20;
+    size_t capacity = 4096;
+    struct locked_ring locked;
+    struct aesd_mpsc_ring mpsc;
+    bool ok = true;
+    int opt_char;
+
+    // -p <n>: most producers, -n <items>: items per producer, -c <slots>: ring capacity
+    while ((opt_char = getopt(argc, argv, "p:n:c:")) != -1)
+    {
+        switch (opt_char)
+        {
+        case 'p':
+            max_producers = strtoul(optarg, NULL, 10);
+            break;
+        case 'n':
+            per_producer = strtoull(optarg, NULL, 0);
+            break;
+        case 'c':
+            capacity = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-p max_producers] [-n items_per_producer] [-c capacity]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (max_producers == 0 || max_producers > MAX_PRODUCERS || per_producer == 0 || per_producer >= (1ULL << 56))
+    {
+        fprintf(stderr, "need 1 to %d producers and at least one item\n", MAX_PRODUCERS);
+        exit(EXIT_FAILURE);
+    }
+
+    if (aesd_mpsc_ring_init(&mpsc, capacity) != 0)
+    {
+        perror("aesd_mpsc_ring_init");
+        exit(EXIT_FAILURE);
+    }
+    pthread_mutex_init(&locked.lock, NULL);
+    locked.mask = mpsc.mask;
+    locked.head = locked.tail = 0;
+    locked.item = calloc(mpsc.mask + 1, sizeof(*locked.item));
+    if (!locked.item)
+        exit(EXIT_FAILURE);
+
+    printf("%-6s %9s %12s %12s %10s %10s %12s\n", "queue", "producers", "items", "Mitems/s",
+           "ns/item", "batch", "full_retries");
+    for (size_t i = 0; i < sizeof(producer_counts) / sizeof(producer_counts[0]); i++)
+    {
+        unsigned int producers = producer_counts[i];
+
+        if (producers > max_producers)
+            break;
+        ok &= bench_one(&queues[0], &locked, producers, per_producer);
+        ok &= bench_one(&queues[1], &mpsc, producers, per_producer);
+    }
+
+    free(locked.item);
+    pthread_mutex_destroy(&locked.lock);
+    aesd_mpsc_ring_destroy(&mpsc);
+    return ok ? 0 : EXIT_FAILURE;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,12 +14,23 @@
 #include <errno.h>
 #include <arpa/inet.h>
 #include <pthread.h>
-#include "linkedlist.h"
+#include <stdint.h>
+#include <time.h>
+#include "write_scheduler.h"
+#include "coroutine.h"
 #include "aesd_ioctl.h"
+#include "aesdsocket_probes.h"
+#include "memsearch.h"
+#include "history_store.h"
+#include "lz4block.h"
+#include "history_mmap.h"
 
 #define SOCKET_PORT "9000"
 #define BUFFER_SIZE 1024
 #define SEEKTO_PREFIX "AESDCHAR_IOCSEEKTO:"
+#define FIND_PREFIX "FIND:"
+#define COMPRESSED_PREFIX "AESDSOCKET_COMPRESSED:"
+#define STREAM_BUFFER_SIZE (64 * 1024)
 
 #define USE_AESD_CHAR_DEVICE 1
 
@@ -29,6 +41,15 @@
 #endif
 
 volatile sig_atomic_t b_shutdown = 0;
+volatile sig_atomic_t b_dump_metrics = 0;
+
+AESD_PROBE_SEMAPHORE(accept);
+AESD_PROBE_SEMAPHORE(packet_complete);
+AESD_PROBE_SEMAPHORE(device_write_start);
+AESD_PROBE_SEMAPHORE(device_write_end);
+AESD_PROBE_SEMAPHORE(reply_start);
+AESD_PROBE_SEMAPHORE(reply_end);
+AESD_PROBE_SEMAPHORE(seek_read);
 
 void signal_handler(int signum)
 {
@@ -36,47 +57,260 @@ void signal_handler(int signum)
     {
         b_shutdown = 1;
     }
+    else if (signum == SIGUSR1)
+    {
+        b_dump_metrics = 1;
+    }
 }
 
 typedef struct
 {
-    FILE *rx_file; // logging fd
-    pthread_mutex_t mutex;
+    history_store_t *history; // compressed history, file backend only
+    write_sched_t *sched; // fair scheduler in front of device commits
 } server_info_t;
 
 typedef struct
 {
     server_info_t server_info;
+    uint64_t conn_id; // connection ID reported by the USDT probes
     int client_fd;
     struct sockaddr client_addr;
     socklen_t client_addr_len;
 } thread_info_t;
 
-int write_data_to_file(FILE *file, pthread_mutex_t *mutex, const char *data, size_t len)
+/*
+ * Monotonic timestamp for probe timings, only taken while a tracer is attached.
+ * A timed probe fires only if its start time was taken, so a tracer attaching
+ * mid-packet never sees a duration measured from 0.
+ */
+static uint64_t probe_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Commit callback for the write scheduler; only ever runs on its committer thread */
+int write_data_to_file(const char *data, size_t len, void *arg)
 {
-    pthread_mutex_lock(mutex);
 #ifdef USE_AESD_CHAR_DEVICE
     /* For char device, open/write/close each time to avoid holding reference */
-    (void)file; /* unused when using char device */
+    (void)arg; /* no history store when using char device */
     int fd = open(SOCKET_RECV_FILE, O_WRONLY | O_APPEND);
     if (fd < 0) {
-        pthread_mutex_unlock(mutex);
+        syslog(LOG_ERR, "Failed to open %s: %s", SOCKET_RECV_FILE, strerror(errno));
         return -1;
     }
     ssize_t written = write(fd, data, len);
+    if ((size_t)written != len)
+    {
+        syslog(LOG_ERR, "Failed to write %zu bytes to %s: %s", len, SOCKET_RECV_FILE,
+               written < 0 ? strerror(errno) : "short write");
+        close(fd);
+        return -1;
+    }
     close(fd);
+    return 0;
 #else
-    size_t written = fwrite(data, 1, len, file);
-    fflush(file);
+    if (hs_append(arg, data, len) != 0)
+    {
+        syslog(LOG_ERR, "Failed to append %zu bytes to history: %s", len, strerror(errno));
+        return -1;
+    }
+    return 0;
 #endif
-    pthread_mutex_unlock(mutex);
-    if ((size_t)written != len)
+}
+
+/*
+ * Pass the whole history to fn in order, in chunks. Returns 0 on success, -1 on failure or if fn stopped it.
+ * The file and device reads block the worker thread (see coroutine.h).
+ */
+static int stream_history(server_info_t *server_info, hs_chunk_fn fn, void *arg)
+{
+#ifdef USE_AESD_CHAR_DEVICE
+    (void)server_info;
+    int fd = open(SOCKET_RECV_FILE, O_RDONLY);
+    if (fd < 0)
+    {
+        return -1;
+    }
+    /* Copies straight out of the driver's mapping when it can */
+    int ret = hm_stream(fd, STREAM_BUFFER_SIZE, fn, arg);
+    close(fd);
+    return ret;
+#else
+    return hs_read(server_info->history, fn, arg);
+#endif
+}
+
+typedef struct
+{
+    char *data;
+    size_t len;
+    size_t cap;
+} history_buffer_t;
+
+static int append_chunk(const char *data, size_t len, void *arg)
+{
+    history_buffer_t *hb = arg;
+    if (hb->len + len > hb->cap)
+    {
+        size_t cap = hb->cap ? hb->cap : STREAM_BUFFER_SIZE;
+        while (cap < hb->len + len)
+        {
+            cap *= 2;
+        }
+        char *grown = realloc(hb->data, cap);
+        if (!grown)
+        {
+            return -1;
+        }
+        hb->data = grown;
+        hb->cap = cap;
+    }
+    memcpy(hb->data + hb->len, data, len);
+    hb->len += len;
+    return 0;
+}
+
+/* Read the whole history into a malloc'd buffer. Returns 0 on success. */
+static int read_history(server_info_t *server_info, char **out, size_t *out_len)
+{
+    history_buffer_t hb = {0};
+    if (stream_history(server_info, append_chunk, &hb) != 0 || append_chunk("", 0, &hb) != 0)
     {
+        free(hb.data);
         return -1;
     }
+    *out = hb.data;
+    *out_len = hb.len;
     return 0;
 }
 
+typedef struct
+{
+    int client_fd;
+    size_t bytes;       /* sent so far */
+    char *raw;          /* compressed replies: raw bytes not yet encoded, HS_BLOCK_SIZE */
+    size_t raw_len;
+    char *encoded;      /* compressed replies: one encoded block */
+} reply_ctx_t;
+
+static int send_chunk(const char *data, size_t len, void *arg)
+{
+    reply_ctx_t *ctx = arg;
+    if (co_send(ctx->client_fd, data, len, 0) < 0)
+    {
+        return -1;
+    }
+    ctx->bytes += len;
+    return 0;
+}
+
+#ifdef USE_AESD_CHAR_DEVICE
+static int send_encoded_block(reply_ctx_t *ctx)
+{
+    size_t encoded_len = hs_encode_block(ctx->raw, ctx->raw_len, ctx->encoded);
+    ctx->raw_len = 0;
+    return send_chunk(ctx->encoded, encoded_len, ctx);
+}
+
+/* Collect raw history into HS_BLOCK_SIZE blocks and send each one encoded */
+static int send_compressed_chunk(const char *data, size_t len, void *arg)
+{
+    reply_ctx_t *ctx = arg;
+    while (len > 0)
+    {
+        size_t n = HS_BLOCK_SIZE - ctx->raw_len;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(ctx->raw + ctx->raw_len, data, n);
+        ctx->raw_len += n;
+        data += n;
+        len -= n;
+        if (ctx->raw_len == HS_BLOCK_SIZE && send_encoded_block(ctx) != 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+#endif
+
+/*
+ * Send the whole history to the client. Clients that asked for a compressed
+ * reply get it as a sequence of history_store.h blocks.
+ */
+static size_t send_history(server_info_t *server_info, int client_fd, int compressed)
+{
+    reply_ctx_t ctx = { .client_fd = client_fd };
+    int ret;
+    if (!compressed)
+    {
+        ret = stream_history(server_info, send_chunk, &ctx);
+    }
+    else
+    {
+#ifndef USE_AESD_CHAR_DEVICE
+        /* Stored blocks go out as they are */
+        ret = hs_read_blocks(server_info->history, send_chunk, &ctx);
+#else
+        ctx.raw = malloc(HS_BLOCK_SIZE);
+        ctx.encoded = malloc(HS_HEADER_SIZE + LZ4B_BOUND(HS_BLOCK_SIZE));
+        ret = -1;
+        if (ctx.raw && ctx.encoded && stream_history(server_info, send_compressed_chunk, &ctx) == 0)
+        {
+            ret = ctx.raw_len > 0 ? send_encoded_block(&ctx) : 0;
+        }
+        free(ctx.encoded);
+        free(ctx.raw);
+#endif
+    }
+    if (ret != 0)
+    {
+        syslog(LOG_ERR, "History reply to fd %d stopped after %zu bytes", client_fd, ctx.bytes);
+    }
+    return ctx.bytes;
+}
+
+/* Send one FIND result as "<write_cmd>:<entry>", stopping the search if the client is gone */
+static int send_find_entry(uint32_t write_cmd, const char *entry, size_t len, void *arg)
+{
+    int client_fd = *(int *)arg;
+    char prefix[16];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "%u:", write_cmd);
+    if (co_send(client_fd, prefix, prefix_len, 0) != prefix_len ||
+        co_send(client_fd, entry, len, 0) != (ssize_t)len)
+    {
+        syslog(LOG_ERR, "FIND reply to fd %d failed: %s", client_fd, strerror(co_errno()));
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Reply with every history entry containing pattern, each prefixed with its
+ * write command index ("<write_cmd>:<entry>") so it can be fed straight to
+ * AESDCHAR_IOCSEEKTO. Entries are the newline terminated packets written by
+ * clients. Returns the number of matching entries sent.
+ */
+static size_t send_find_results(server_info_t *server_info, int client_fd, const char *pattern, size_t pattern_len)
+{
+    char *history;
+    size_t history_len;
+    if (read_history(server_info, &history, &history_len) != 0)
+    {
+        syslog(LOG_ERR, "Failed to read %s for FIND: %s", SOCKET_RECV_FILE, strerror(co_errno()));
+        return 0;
+    }
+
+    size_t matches = memsearch_entries(history, history_len, pattern, pattern_len, send_find_entry, &client_fd);
+    free(history);
+    return matches;
+}
+
 int log_time(server_info_t *server_info)
 {
 
@@ -105,7 +339,7 @@ int log_time(server_info_t *server_info)
             return -1;
         }
 
-        if (write_data_to_file(server_info->rx_file, &server_info->mutex, time_buffer, time_len) != 0)
+        if (ws_submit(server_info->sched, "timestamp", time_buffer, time_len) != 0)
         {
             return -1;
         }
@@ -127,17 +361,19 @@ int on_connect(thread_info_t *thread_info)
 
     ssize_t recvd;
     int found_newline = 0;
+    uint64_t conn_id = thread_info->conn_id;
+    uint64_t start_ns = AESD_PROBE_ENABLED(packet_complete) ? probe_now_ns() : 0;
 
     /* Accumulate received data until newline */
     do
     {
-        recvd = recv(thread_info->client_fd, buffer, BUFFER_SIZE, 0);
+        recvd = co_recv(thread_info->client_fd, buffer, BUFFER_SIZE, 0);
         if (recvd > 0)
         {
             char *new_recv_buffer = realloc(recv_buffer, recv_buffer_size + recvd + 1);
             if (!new_recv_buffer)
             {
-                perror("realloc failed");
+                syslog(LOG_ERR, "realloc failed: %s", strerror(co_errno()));
                 free(recv_buffer);
                 close(thread_info->client_fd);
                 free(thread_info);
@@ -154,6 +390,10 @@ int on_connect(thread_info_t *thread_info)
                 break;
             }
         }
+        else if (recvd < 0)
+        {
+            syslog(LOG_ERR, "recv from %s failed: %s", client_ip, strerror(co_errno()));
+        }
     } while (recvd > 0);
 
     if (!found_newline || recv_buffer_size == 0)
@@ -163,6 +403,10 @@ int on_connect(thread_info_t *thread_info)
         free(thread_info);
         return 0;
     }
+    if (start_ns)
+    {
+        AESD_PROBE3(packet_complete, conn_id, recv_buffer_size, probe_now_ns() - start_ns);
+    }
 
     /* Check if this is an IOCSEEKTO command */
     syslog(LOG_DEBUG, "Checking command (len=%zu): first 30 chars='%.30s'", recv_buffer_size, recv_buffer);
@@ -178,28 +422,38 @@ int on_connect(thread_info_t *thread_info)
             int fd = open(SOCKET_RECV_FILE, O_RDWR);
             if (fd >= 0)
             {
+                uint64_t read_start_ns = AESD_PROBE_ENABLED(seek_read) ? probe_now_ns() : 0;
+                size_t bytes_sent = 0;
                 struct aesd_seekto seekto = { .write_cmd = write_cmd, .write_cmd_offset = write_cmd_offset };
                 int ioctl_ret = ioctl(fd, AESDCHAR_IOCSEEKTO, &seekto);
-                syslog(LOG_DEBUG, "ioctl returned %d, errno=%d", ioctl_ret, errno);
+                syslog(LOG_DEBUG, "ioctl returned %d, errno=%d", ioctl_ret, ioctl_ret ? co_errno() : 0);
                 if (ioctl_ret == 0)
                 {
                     /* Check position after ioctl */
                     off_t pos = lseek(fd, 0, SEEK_CUR);
                     syslog(LOG_DEBUG, "Position after ioctl: %ld", (long)pos);
 
-                    /* Read from seeked position and send back */
+                    /* Read from seeked position and send back, many entries per read */
+                    char *chunk = malloc(STREAM_BUFFER_SIZE);
                     ssize_t bytes_read;
-                    while ((bytes_read = read(fd, buffer, BUFFER_SIZE)) > 0)
+                    while (chunk && (bytes_read = read(fd, chunk, STREAM_BUFFER_SIZE)) > 0)
                     {
                         syslog(LOG_DEBUG, "Read %zd bytes", bytes_read);
-                        send(thread_info->client_fd, buffer, bytes_read, 0);
+                        co_send(thread_info->client_fd, chunk, bytes_read, 0);
+                        bytes_sent += bytes_read;
                     }
+                    free(chunk);
                 }
                 close(fd);
+                if (read_start_ns)
+                {
+                    AESD_PROBE5(seek_read, conn_id, write_cmd, write_cmd_offset, bytes_sent,
+                                probe_now_ns() - read_start_ns);
+                }
             }
             else
             {
-                syslog(LOG_ERR, "Failed to open %s for ioctl: %s", SOCKET_RECV_FILE, strerror(errno));
+                syslog(LOG_ERR, "Failed to open %s for ioctl: %s", SOCKET_RECV_FILE, strerror(co_errno()));
             }
         }
         else
@@ -207,35 +461,57 @@ int on_connect(thread_info_t *thread_info)
             syslog(LOG_ERR, "Failed to parse IOCSEEKTO parameters from: %s", recv_buffer);
         }
     }
+    else if (strncmp(recv_buffer, FIND_PREFIX, strlen(FIND_PREFIX)) == 0)
+    {
+        const char *pattern = recv_buffer + strlen(FIND_PREFIX);
+        size_t pattern_len = strcspn(pattern, "\r\n");
+        if (pattern_len > 0)
+        {
+            size_t matches = send_find_results(&thread_info->server_info, thread_info->client_fd, pattern, pattern_len);
+            syslog(LOG_DEBUG, "FIND '%.*s' matched %zu entries", (int)pattern_len, pattern, matches);
+        }
+        else
+        {
+            syslog(LOG_ERR, "Empty FIND pattern");
+        }
+    }
     else
     {
-
-        if (write_data_to_file(thread_info->server_info.rx_file, &thread_info->server_info.mutex, recv_buffer, recv_buffer_size) != 0)
+        /* Clients opt in to a compressed reply by prefixing their packet */
+        const char *packet = recv_buffer;
+        size_t packet_len = recv_buffer_size;
+        int compressed = strncmp(recv_buffer, COMPRESSED_PREFIX, strlen(COMPRESSED_PREFIX)) == 0;
+        if (compressed)
         {
-            perror("write to file failed");
-            free(recv_buffer);
-            close(thread_info->client_fd);
-            free(thread_info);
-            return -1;
+            packet += strlen(COMPRESSED_PREFIX);
+            packet_len -= strlen(COMPRESSED_PREFIX);
         }
 
-
-        FILE *fp = fopen(SOCKET_RECV_FILE, "r");
-        if (!fp)
+        uint64_t write_start_ns = AESD_PROBE_ENABLED(device_write_end) ? probe_now_ns() : 0;
+        AESD_PROBE2(device_write_start, conn_id, packet_len);
+        int write_ret = co_write_device(thread_info->server_info.sched, client_ip, packet, packet_len);
+        if (write_start_ns)
+        {
+            AESD_PROBE4(device_write_end, conn_id, packet_len, probe_now_ns() - write_start_ns, write_ret);
+        }
+        if (write_ret != 0)
         {
-            perror("fopen read");
+            /* The committer thread logged why */
+            syslog(LOG_ERR, "Write from %s to %s failed", client_ip, SOCKET_RECV_FILE);
             free(recv_buffer);
             close(thread_info->client_fd);
             free(thread_info);
             return -1;
         }
 
-        while ((recvd = fread(buffer, 1, BUFFER_SIZE, fp)) > 0)
+
+        uint64_t reply_start_ns = AESD_PROBE_ENABLED(reply_end) ? probe_now_ns() : 0;
+        AESD_PROBE1(reply_start, conn_id);
+        size_t reply_bytes = send_history(&thread_info->server_info, thread_info->client_fd, compressed);
+        if (reply_start_ns)
         {
-            send(thread_info->client_fd, buffer, recvd, 0);
+            AESD_PROBE3(reply_end, conn_id, reply_bytes, probe_now_ns() - reply_start_ns);
         }
-
-        fclose(fp);
     }
 
     free(recv_buffer);
@@ -244,12 +520,22 @@ int on_connect(thread_info_t *thread_info)
     return 0;
 }
 
+/* Coroutine entry point: one per accepted connection */
+void on_connect_co(void *arg)
+{
+    on_connect(arg);
+}
+
 int main(int argc, char *argv[])
 {
     int sockfd, new_fd;
     struct addrinfo hints = {0}, *res;
 
     int daemon_mode = 0;
+    uint64_t next_conn_id = 0;
+    size_t rate_limit = 0;
+    size_t workers = 0;
+    int opt_char;
 
     // Open syslog
     openlog("aesdsocket", LOG_PID | LOG_CONS, LOG_USER);
@@ -259,11 +545,26 @@ int main(int argc, char *argv[])
     struct sigaction sa = {.sa_handler = signal_handler};
     sigaction(SIGINT, &sa, NULL);
     sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
 
-    // Check for daemon flag
-    if (argc > 1 && strcmp(argv[1], "-d") == 0)
+    // -d: daemon mode, -r <bytes/s>: per-client write rate limit, -w <n>: connection worker threads
+    while ((opt_char = getopt(argc, argv, "dr:w:")) != -1)
     {
-        daemon_mode = 1;
+        switch (opt_char)
+        {
+        case 'd':
+            daemon_mode = 1;
+            break;
+        case 'r':
+            rate_limit = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            workers = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-d] [-r bytes_per_sec] [-w workers]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
     }
 
     // Set up address info
@@ -319,23 +620,43 @@ int main(int argc, char *argv[])
         exit(EXIT_SUCCESS);
     }
 
-    listen(sockfd, 10);
+    listen(sockfd, SOMAXCONN);
     syslog(LOG_INFO, "Listening on port %s", SOCKET_PORT);
 
     server_info_t server_info = {0};
-    pthread_mutex_init(&server_info.mutex, NULL);
+#ifndef USE_AESD_CHAR_DEVICE
+    server_info.history = hs_open(SOCKET_RECV_FILE);
+    if (!server_info.history)
+    {
+        perror("history store open failed");
+        return -1;
+    }
+#endif
+    server_info.sched = ws_create(write_data_to_file, server_info.history, 0);
+    if (!server_info.sched)
+    {
+        perror("write scheduler creation failed");
+        return -1;
+    }
+    ws_set_rate_limit(server_info.sched, rate_limit, 0);
 
 
-    linked_list_t *thread_list = ll_create();
-    if (!thread_list)
+    co_runtime_t *runtime = co_runtime_create(workers, 0);
+    if (!runtime)
     {
-        perror("linked list creation failed");
+        perror("coroutine runtime creation failed");
         return -1;
     }
 
 
     while (!b_shutdown)
     {
+        if (b_dump_metrics)
+        {
+            b_dump_metrics = 0;
+            ws_log_metrics(server_info.sched);
+        }
+
         thread_info_t *thread_info = malloc(sizeof(thread_info_t));
         if (!thread_info)
         {
@@ -356,39 +677,26 @@ int main(int argc, char *argv[])
         }
 
         thread_info->client_fd = new_fd;
-        pthread_t thread_id = 0;
-        int ret = pthread_create(&thread_id, NULL, (void *(*)(void *))on_connect, (void *)thread_info);
-        if (ret != 0)
+        thread_info->conn_id = ++next_conn_id;
+        AESD_PROBE2(accept, thread_info->conn_id, new_fd);
+        if (co_spawn(runtime, on_connect_co, thread_info) != 0)
         {
-            perror("pthread_create failed");
+            // Out of memory for this connection only; keep serving the others
+            perror("co_spawn failed");
+            close(new_fd);
             free(thread_info);
-            break;
+            continue;
         }
-
-        pthread_t *thread_id_ptr = malloc(sizeof(pthread_t));
-        if (!thread_id_ptr)
-        {
-            perror("malloc failed");
-            break;
-        }
-        *thread_id_ptr = thread_id;
-        ll_push_back(thread_list, thread_id_ptr);
     }
 
-    // Close all threads
-    while (ll_size(thread_list) > 0)
-    {
-        pthread_t *thread_id = ll_pop_front(thread_list);
-        pthread_join(*thread_id, NULL);
-        free(thread_id);
-    }
+    // Wait for all connections to finish
+    co_runtime_destroy(runtime);
 
-    
     // Cleanup
     syslog(LOG_INFO, "Shutting down server...");
-    ll_destroy(thread_list, free);
 
-    pthread_mutex_destroy(&server_info.mutex);
+    ws_destroy(server_info.sched);
+    hs_close(server_info.history);
     close(sockfd);
     freeaddrinfo(res);
 
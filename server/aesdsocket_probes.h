@@ -0,0 +1,57 @@
+#ifndef AESDSOCKET_PROBES_H
+#define AESDSOCKET_PROBES_H
+
+/*
+ * USDT static probes for aesdsocket.
+ *
+ * Probes compile to a nop plus an ELF note when <sys/sdt.h> is available
+ * (systemtap-sdt-dev / systemtap-sdt-devel) and to nothing otherwise, or
+ * when built with -DAESD_NO_USDT.  Each probe has a semaphore so timing
+ * arguments are only measured while a tracer is attached, e.g.
+ *
+ *   bpftrace -l 'usdt:/usr/bin/aesdsocket:*'
+ *   bpftrace -e 'usdt:/usr/bin/aesdsocket:aesdsocket:device_write_end { @ns = hist(arg2); }'
+ *
+ * Probes carrying a duration do not fire for an operation that began before
+ * the tracer attached.
+ *
+ * Probe                                     Arguments
+ * accept                                    conn_id, client_fd
+ * packet_complete                           conn_id, bytes, recv_ns
+ * device_write_start                        conn_id, bytes
+ * device_write_end                          conn_id, bytes, write_ns, result
+ * reply_start                               conn_id
+ * reply_end                                 conn_id, bytes, reply_ns
+ * seek_read                                 conn_id, write_cmd, write_cmd_offset, bytes, read_ns
+ */
+
+#if !defined(AESD_NO_USDT) && defined(__has_include)
+#  if __has_include(<sys/sdt.h>)
+#    define _SDT_HAS_SEMAPHORES 1
+#    include <sys/sdt.h>
+#    define AESD_USDT 1
+#  endif
+#endif
+
+#ifdef AESD_USDT
+#  define AESD_PROBE_SEMAPHORE(name) \
+    unsigned short aesdsocket_##name##_semaphore __attribute__((unused, section(".probes")))
+#  define AESD_PROBE_ENABLED(name)  __builtin_expect(aesdsocket_##name##_semaphore != 0, 0)
+#  define AESD_PROBE1(name, a)                  STAP_PROBE1(aesdsocket, name, a)
+#  define AESD_PROBE2(name, a, b)               STAP_PROBE2(aesdsocket, name, a, b)
+#  define AESD_PROBE3(name, a, b, c)            STAP_PROBE3(aesdsocket, name, a, b, c)
+#  define AESD_PROBE4(name, a, b, c, d)         STAP_PROBE4(aesdsocket, name, a, b, c, d)
+#  define AESD_PROBE5(name, a, b, c, d, e)      STAP_PROBE5(aesdsocket, name, a, b, c, d, e)
+#else
+#  define AESD_PROBE_SEMAPHORE(name) \
+    extern unsigned short aesdsocket_##name##_semaphore_unused
+#  define AESD_PROBE_ENABLED(name)  0
+/* Arguments are still referenced so probe-only locals don't warn; they fold away */
+#  define AESD_PROBE1(name, a)                  do { (void)(a); } while (0)
+#  define AESD_PROBE2(name, a, b)               do { (void)(a); (void)(b); } while (0)
+#  define AESD_PROBE3(name, a, b, c)            do { (void)(a); (void)(b); (void)(c); } while (0)
+#  define AESD_PROBE4(name, a, b, c, d)         do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+#  define AESD_PROBE5(name, a, b, c, d, e)      do { (void)(a); (void)(b); (void)(c); (void)(d); (void)(e); } while (0)
+#endif
+
+#endif /* AESDSOCKET_PROBES_H */
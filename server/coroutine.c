@@ -0,0 +1,696 @@
+/*
+ * coroutine.c
+ *
+ * ucontext based M:N coroutine scheduler with work-stealing run queues and
+ * an epoll poller thread for socket readiness.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include "coroutine.h"
+
+#define CO_DEFAULT_STACK_SIZE (64 * 1024)
+#define CO_MAX_WORKERS 64
+#define CO_POLL_EVENTS 64
+#define CO_STACKS_PER_CHUNK 64
+
+typedef enum
+{
+    CO_PARK_YIELD,      /* requeue immediately */
+    CO_PARK_FD,         /* wait for fd readiness on the poller */
+    CO_PARK_WRITE,      /* wait for the write scheduler to commit */
+} co_park_t;
+
+typedef struct co
+{
+    ucontext_t ctx;
+    void *stack;            /* low end of the stack, from the runtime's stack pool */
+    co_fn fn;
+    void *arg;
+    co_runtime_t *rt;
+    int done;
+
+    /* Set by the coroutine before switching out, acted on by the worker afterwards */
+    co_park_t park;
+    int park_fd;
+    uint32_t park_events;
+    write_sched_t *park_sched;
+    const char *park_key;
+    const char *park_data;
+    size_t park_len;
+    int park_result;
+
+    struct co *next;
+} co_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    co_t *head;
+    co_t *tail;
+} co_queue_t;
+
+/*
+ * Stacks are carved out of chunks of CO_STACKS_PER_CHUNK, each one mapping
+ * with a PROT_NONE guard page below every stack, so an overflow faults
+ * instead of corrupting a neighbour.  Each guard splits the mapping, costing
+ * two VMAs per stack: with vm.max_map_count at its default of 65530 the
+ * server tops out near 32k live connections, after which co_spawn fails.
+ */
+typedef struct co_chunk
+{
+    void *map;
+    size_t map_size;
+    struct co_chunk *next;
+} co_chunk_t;
+
+typedef struct co_worker
+{
+    co_runtime_t *rt;
+    size_t id;
+    pthread_t thread;
+    ucontext_t sched_ctx;
+    co_t *current;
+    co_queue_t queue;
+} co_worker_t;
+
+struct co_runtime
+{
+    co_worker_t workers[CO_MAX_WORKERS];
+    size_t nworkers;
+    size_t stack_size;
+    size_t page_size;
+    atomic_size_t next_worker;  /* round-robin target for wakeups from non-worker threads */
+
+    pthread_mutex_t stack_mutex;
+    co_chunk_t *chunks;
+    void *free_stacks;          /* linked through each free stack's lowest word */
+
+    pthread_mutex_t idle_mutex;
+    pthread_cond_t idle_cond;
+    atomic_int idle_workers;
+    int stopping;
+
+    pthread_mutex_t live_mutex;
+    pthread_cond_t live_cond;
+    size_t live;
+
+    int epoll_fd;
+    int wake_fd;
+    pthread_t poller;
+};
+
+static __thread co_worker_t *tls_worker;
+
+/*
+ * A coroutine can migrate between worker threads while it is parked, so the
+ * compiler must not cache thread-local addresses (including errno) across a
+ * switch.  Anything thread-local is read through these non-inlined helpers.
+ */
+static __attribute__((noinline)) co_worker_t *co_self_worker(void)
+{
+    return tls_worker;
+}
+
+static __attribute__((noinline)) void co_errno_set(int err)
+{
+    errno = err;
+}
+
+__attribute__((noinline)) int co_errno(void)
+{
+    return errno;
+}
+
+static void co_queue_push(co_queue_t *q, co_t *co)
+{
+    co->next = NULL;
+    pthread_mutex_lock(&q->mutex);
+    if (q->tail)
+    {
+        q->tail->next = co;
+    }
+    else
+    {
+        q->head = co;
+    }
+    q->tail = co;
+    pthread_mutex_unlock(&q->mutex);
+}
+
+static co_t *co_queue_pop(co_queue_t *q)
+{
+    pthread_mutex_lock(&q->mutex);
+    co_t *co = q->head;
+    if (co)
+    {
+        q->head = co->next;
+        if (!q->head)
+        {
+            q->tail = NULL;
+        }
+    }
+    pthread_mutex_unlock(&q->mutex);
+    return co;
+}
+
+static co_t *co_next_runnable(co_worker_t *w)
+{
+    co_runtime_t *rt = w->rt;
+    co_t *co = co_queue_pop(&w->queue);
+    if (co)
+    {
+        return co;
+    }
+    /* Steal from the other workers, starting with our neighbour */
+    for (size_t i = 1; i < rt->nworkers; i++)
+    {
+        co = co_queue_pop(&rt->workers[(w->id + i) % rt->nworkers].queue);
+        if (co)
+        {
+            return co;
+        }
+    }
+    return NULL;
+}
+
+/* Make co runnable. Safe to call from any thread. */
+static void co_ready(co_t *co)
+{
+    co_runtime_t *rt = co->rt;
+    co_worker_t *w = co_self_worker();
+    if (!w || w->rt != rt)
+    {
+        w = &rt->workers[atomic_fetch_add(&rt->next_worker, 1) % rt->nworkers];
+    }
+    co_queue_push(&w->queue, co);
+
+    /* Pairs with the idle_workers increment in co_worker_main */
+    if (atomic_load(&rt->idle_workers) > 0)
+    {
+        pthread_mutex_lock(&rt->idle_mutex);
+        pthread_cond_signal(&rt->idle_cond);
+        pthread_mutex_unlock(&rt->idle_mutex);
+    }
+}
+
+static void co_write_done(int result, void *arg)
+{
+    co_t *co = arg;
+    co->park_result = result;
+    co_ready(co);
+}
+
+/* Map a new chunk and put its stacks on the free list. Called with stack_mutex held. */
+static int co_chunk_grow(co_runtime_t *rt)
+{
+    co_chunk_t *chunk = malloc(sizeof(*chunk));
+    if (!chunk)
+    {
+        return -1;
+    }
+    size_t slot = rt->page_size + rt->stack_size;
+    chunk->map_size = CO_STACKS_PER_CHUNK * slot;
+    chunk->map = mmap(NULL, chunk->map_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (chunk->map == MAP_FAILED)
+    {
+        free(chunk);
+        return -1;
+    }
+    /* Stacks grow down: each one's guard page sits just below it */
+    for (size_t i = 0; i < CO_STACKS_PER_CHUNK; i++)
+    {
+        if (mprotect((char *)chunk->map + i * slot, rt->page_size, PROT_NONE) != 0)
+        {
+            /* Out of VMAs (vm.max_map_count) */
+            munmap(chunk->map, chunk->map_size);
+            free(chunk);
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < CO_STACKS_PER_CHUNK; i++)
+    {
+        void **stack = (void **)((char *)chunk->map + i * slot + rt->page_size);
+        *stack = rt->free_stacks;
+        rt->free_stacks = stack;
+    }
+    chunk->next = rt->chunks;
+    rt->chunks = chunk;
+    return 0;
+}
+
+static void *co_stack_alloc(co_runtime_t *rt)
+{
+    void **stack = NULL;
+
+    pthread_mutex_lock(&rt->stack_mutex);
+    if (rt->free_stacks || co_chunk_grow(rt) == 0)
+    {
+        stack = rt->free_stacks;
+        rt->free_stacks = *stack;
+    }
+    pthread_mutex_unlock(&rt->stack_mutex);
+    return stack;
+}
+
+static void co_stack_free(co_runtime_t *rt, void *stack)
+{
+    pthread_mutex_lock(&rt->stack_mutex);
+    *(void **)stack = rt->free_stacks;
+    rt->free_stacks = stack;
+    pthread_mutex_unlock(&rt->stack_mutex);
+}
+
+static void co_free(co_t *co)
+{
+    co_stack_free(co->rt, co->stack);
+    free(co);
+}
+
+/* Runs on the worker after co has switched out; co may be resumed elsewhere as soon as it is handed off. */
+static void co_park_complete(co_worker_t *w, co_t *co)
+{
+    co_runtime_t *rt = w->rt;
+
+    switch (co->park)
+    {
+    case CO_PARK_FD:
+    {
+        struct epoll_event ev = { .events = co->park_events | EPOLLONESHOT, .data.ptr = co };
+        if (epoll_ctl(rt->epoll_fd, EPOLL_CTL_MOD, co->park_fd, &ev) == 0 ||
+            (errno == ENOENT && epoll_ctl(rt->epoll_fd, EPOLL_CTL_ADD, co->park_fd, &ev) == 0))
+        {
+            return;
+        }
+        co->park_result = -errno;
+        break;
+    }
+    case CO_PARK_WRITE:
+        if (ws_submit_async(co->park_sched, co->park_key, co->park_data, co->park_len,
+                            co_write_done, co) == 0)
+        {
+            return;
+        }
+        co->park_result = -1;
+        break;
+    case CO_PARK_YIELD:
+        break;
+    }
+    co_queue_push(&w->queue, co);
+}
+
+static void *co_worker_main(void *arg)
+{
+    co_worker_t *w = arg;
+    co_runtime_t *rt = w->rt;
+    tls_worker = w;
+
+    for (;;)
+    {
+        co_t *co = co_next_runnable(w);
+        if (!co)
+        {
+            pthread_mutex_lock(&rt->idle_mutex);
+            atomic_fetch_add(&rt->idle_workers, 1);
+            while (!rt->stopping && !(co = co_next_runnable(w)))
+            {
+                pthread_cond_wait(&rt->idle_cond, &rt->idle_mutex);
+            }
+            atomic_fetch_sub(&rt->idle_workers, 1);
+            pthread_mutex_unlock(&rt->idle_mutex);
+            if (!co)
+            {
+                break;
+            }
+        }
+
+        w->current = co;
+        swapcontext(&w->sched_ctx, &co->ctx);
+        w->current = NULL;
+
+        if (co->done)
+        {
+            co_free(co);
+            pthread_mutex_lock(&rt->live_mutex);
+            if (--rt->live == 0)
+            {
+                pthread_cond_broadcast(&rt->live_cond);
+            }
+            pthread_mutex_unlock(&rt->live_mutex);
+        }
+        else
+        {
+            co_park_complete(w, co);
+        }
+    }
+    return NULL;
+}
+
+static void *co_poller_main(void *arg)
+{
+    co_runtime_t *rt = arg;
+    struct epoll_event events[CO_POLL_EVENTS];
+
+    for (;;)
+    {
+        int n = epoll_wait(rt->epoll_fd, events, CO_POLL_EVENTS, -1);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            if (!events[i].data.ptr)
+            {
+                /* wake_fd: runtime is stopping */
+                return NULL;
+            }
+            co_t *co = events[i].data.ptr;
+            co->park_result = 0;
+            co_ready(co);
+        }
+    }
+    return NULL;
+}
+
+/* Switch from the running coroutine back to its worker's scheduler. */
+static void co_switch_out(co_park_t park)
+{
+    co_worker_t *w = co_self_worker();
+    co_t *co = w->current;
+    co->park = park;
+    swapcontext(&co->ctx, &w->sched_ctx);
+}
+
+static void co_trampoline(unsigned int lo, unsigned int hi)
+{
+    co_t *co = (co_t *)(uintptr_t)(((uint64_t)hi << 32) | lo);
+    co->fn(co->arg);
+    co->done = 1;
+    co_switch_out(CO_PARK_YIELD);
+}
+
+co_runtime_t *co_runtime_create(size_t workers, size_t stack_size)
+{
+    co_runtime_t *rt = calloc(1, sizeof(*rt));
+    if (!rt)
+    {
+        return NULL;
+    }
+
+    if (!workers)
+    {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = ncpu > 0 ? (size_t)ncpu : 1;
+    }
+    if (workers > CO_MAX_WORKERS)
+    {
+        workers = CO_MAX_WORKERS;
+    }
+    rt->nworkers = workers;
+    rt->page_size = (size_t)sysconf(_SC_PAGESIZE);
+    stack_size = stack_size ? stack_size : CO_DEFAULT_STACK_SIZE;
+    rt->stack_size = (stack_size + rt->page_size - 1) & ~(rt->page_size - 1);
+
+    pthread_mutex_init(&rt->idle_mutex, NULL);
+    pthread_cond_init(&rt->idle_cond, NULL);
+    pthread_mutex_init(&rt->live_mutex, NULL);
+    pthread_cond_init(&rt->live_cond, NULL);
+    pthread_mutex_init(&rt->stack_mutex, NULL);
+
+    rt->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    rt->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (rt->epoll_fd < 0 || rt->wake_fd < 0)
+    {
+        goto fail;
+    }
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+    if (epoll_ctl(rt->epoll_fd, EPOLL_CTL_ADD, rt->wake_fd, &ev) != 0)
+    {
+        goto fail;
+    }
+    if (pthread_create(&rt->poller, NULL, co_poller_main, rt) != 0)
+    {
+        goto fail;
+    }
+
+    for (size_t i = 0; i < workers; i++)
+    {
+        co_worker_t *w = &rt->workers[i];
+        w->rt = rt;
+        w->id = i;
+        pthread_mutex_init(&w->queue.mutex, NULL);
+        if (pthread_create(&w->thread, NULL, co_worker_main, w) != 0)
+        {
+            /* Run with the workers we managed to start */
+            rt->nworkers = i;
+            break;
+        }
+    }
+    if (rt->nworkers == 0)
+    {
+        co_runtime_destroy(rt);
+        return NULL;
+    }
+    return rt;
+
+fail:
+    if (rt->epoll_fd >= 0)
+    {
+        close(rt->epoll_fd);
+    }
+    if (rt->wake_fd >= 0)
+    {
+        close(rt->wake_fd);
+    }
+    free(rt);
+    return NULL;
+}
+
+void co_runtime_destroy(co_runtime_t *rt)
+{
+    if (!rt)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&rt->live_mutex);
+    while (rt->live > 0)
+    {
+        pthread_cond_wait(&rt->live_cond, &rt->live_mutex);
+    }
+    pthread_mutex_unlock(&rt->live_mutex);
+
+    pthread_mutex_lock(&rt->idle_mutex);
+    rt->stopping = 1;
+    pthread_cond_broadcast(&rt->idle_cond);
+    pthread_mutex_unlock(&rt->idle_mutex);
+    for (size_t i = 0; i < rt->nworkers; i++)
+    {
+        pthread_join(rt->workers[i].thread, NULL);
+        pthread_mutex_destroy(&rt->workers[i].queue.mutex);
+    }
+
+    uint64_t one = 1;
+    if (write(rt->wake_fd, &one, sizeof(one)) == sizeof(one))
+    {
+        pthread_join(rt->poller, NULL);
+    }
+    close(rt->wake_fd);
+    close(rt->epoll_fd);
+
+    pthread_cond_destroy(&rt->live_cond);
+    pthread_mutex_destroy(&rt->live_mutex);
+    pthread_cond_destroy(&rt->idle_cond);
+    pthread_mutex_destroy(&rt->idle_mutex);
+
+    while (rt->chunks)
+    {
+        co_chunk_t *chunk = rt->chunks;
+        rt->chunks = chunk->next;
+        munmap(chunk->map, chunk->map_size);
+        free(chunk);
+    }
+    pthread_mutex_destroy(&rt->stack_mutex);
+    free(rt);
+}
+
+int co_spawn(co_runtime_t *rt, co_fn fn, void *arg)
+{
+    co_t *co = calloc(1, sizeof(*co));
+    if (!co)
+    {
+        return -1;
+    }
+
+    co->stack = co_stack_alloc(rt);
+    if (!co->stack)
+    {
+        free(co);
+        return -1;
+    }
+
+    co->fn = fn;
+    co->arg = arg;
+    co->rt = rt;
+    getcontext(&co->ctx);
+    co->ctx.uc_stack.ss_sp = co->stack;
+    co->ctx.uc_stack.ss_size = rt->stack_size;
+    co->ctx.uc_link = NULL;
+    uint64_t p = (uintptr_t)co;
+    makecontext(&co->ctx, (void (*)(void))co_trampoline, 2,
+                (unsigned int)(p & 0xffffffffu), (unsigned int)(p >> 32));
+
+    pthread_mutex_lock(&rt->live_mutex);
+    rt->live++;
+    pthread_mutex_unlock(&rt->live_mutex);
+
+    co_ready(co);
+    return 0;
+}
+
+size_t co_live(const co_runtime_t *rt)
+{
+    return rt->live;
+}
+
+static co_t *co_current(void)
+{
+    co_worker_t *w = co_self_worker();
+    return w ? w->current : NULL;
+}
+
+void co_yield(void)
+{
+    if (co_current())
+    {
+        co_switch_out(CO_PARK_YIELD);
+    }
+}
+
+/* Park the current coroutine until fd reports events. Returns 0 or -errno. */
+static int co_wait_fd(int fd, uint32_t events)
+{
+    co_t *co = co_current();
+    co->park_fd = fd;
+    co->park_events = events;
+    co_switch_out(CO_PARK_FD);
+    return co->park_result;
+}
+
+static __attribute__((noinline)) ssize_t co_try_recv(int fd, void *buf, size_t len, int flags, int *err)
+{
+    ssize_t n = recv(fd, buf, len, flags | MSG_DONTWAIT);
+    *err = n < 0 ? errno : 0;
+    return n;
+}
+
+static __attribute__((noinline)) ssize_t co_try_send(int fd, const void *buf, size_t len, int flags, int *err)
+{
+    ssize_t n = send(fd, buf, len, flags | MSG_DONTWAIT | MSG_NOSIGNAL);
+    *err = n < 0 ? errno : 0;
+    return n;
+}
+
+ssize_t co_recv(int fd, void *buf, size_t len, int flags)
+{
+    if (!co_current())
+    {
+        return recv(fd, buf, len, flags);
+    }
+
+    for (;;)
+    {
+        int err;
+        ssize_t n = co_try_recv(fd, buf, len, flags, &err);
+        if (n >= 0)
+        {
+            return n;
+        }
+        if (err == EINTR)
+        {
+            continue;
+        }
+        if (err != EAGAIN && err != EWOULDBLOCK)
+        {
+            co_errno_set(err);
+            return -1;
+        }
+        int ret = co_wait_fd(fd, EPOLLIN | EPOLLRDHUP);
+        if (ret < 0)
+        {
+            co_errno_set(-ret);
+            return -1;
+        }
+    }
+}
+
+ssize_t co_send(int fd, const void *buf, size_t len, int flags)
+{
+    size_t sent = 0;
+    if (!co_current())
+    {
+        return send(fd, buf, len, flags);
+    }
+
+    while (sent < len)
+    {
+        int err;
+        ssize_t n = co_try_send(fd, (const char *)buf + sent, len - sent, flags, &err);
+        if (n >= 0)
+        {
+            sent += (size_t)n;
+            continue;
+        }
+        if (err == EINTR)
+        {
+            continue;
+        }
+        if (err != EAGAIN && err != EWOULDBLOCK)
+        {
+            co_errno_set(err);
+            return sent ? (ssize_t)sent : -1;
+        }
+        int ret = co_wait_fd(fd, EPOLLOUT);
+        if (ret < 0)
+        {
+            co_errno_set(-ret);
+            return sent ? (ssize_t)sent : -1;
+        }
+    }
+    return (ssize_t)sent;
+}
+
+int co_write_device(write_sched_t *sched, const char *client_key, const char *data, size_t len)
+{
+    co_t *co = co_current();
+    if (!co)
+    {
+        return ws_submit(sched, client_key, data, len);
+    }
+
+    co->park_sched = sched;
+    co->park_key = client_key;
+    co->park_data = data;
+    co->park_len = len;
+    co->park_result = -1;
+    co_switch_out(CO_PARK_WRITE);
+    return co->park_result;
+}
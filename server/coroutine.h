@@ -0,0 +1,63 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include "write_scheduler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Stackful M:N coroutine runtime.
+ *
+ * Coroutines run on a small pool of worker threads.  Each worker owns a run
+ * queue and idle workers steal from the others.  The co_* I/O wrappers look
+ * like their blocking counterparts but park the calling coroutine (on an
+ * epoll poller thread or on the write scheduler) instead of blocking the
+ * worker.  Called outside a coroutine they simply block.
+ *
+ * Only sockets can be parked.  epoll rejects regular files and reports the
+ * aesdchar device as always ready, so open/read/ioctl on either run on the
+ * worker and block it.  They copy from the page cache or the driver's ring
+ * without waiting on any client.  While one stalls on disk, idle workers
+ * steal the other coroutines queued behind it.
+ */
+
+typedef struct co_runtime co_runtime_t;
+typedef void (*co_fn)(void *arg);
+
+/* Create/destroy. 0 selects the default worker count / stack size. destroy waits for all coroutines. */
+co_runtime_t *co_runtime_create(size_t workers, size_t stack_size);
+void co_runtime_destroy(co_runtime_t *rt);
+
+/* Start fn(arg) as a new coroutine. Returns 0 on success, -1 on failure. */
+int co_spawn(co_runtime_t *rt, co_fn fn, void *arg);
+
+/* Number of coroutines that have been spawned and not yet finished. */
+size_t co_live(const co_runtime_t *rt);
+
+/* Let other coroutines on this worker run. */
+void co_yield(void);
+
+/* recv()/send() that yield while the socket is not ready. co_send sends the whole buffer and never raises SIGPIPE. */
+ssize_t co_recv(int fd, void *buf, size_t len, int flags);
+ssize_t co_send(int fd, const void *buf, size_t len, int flags);
+
+/* ws_submit() that yields until the packet has been committed. The commit runs on another thread and does not set errno. */
+int co_write_device(write_sched_t *sched, const char *client_key, const char *data, size_t len);
+
+/*
+ * errno of the thread the caller is running on now.  A coroutine can resume
+ * on another worker after any co_* call, and the compiler may reuse errno's
+ * thread-local address from before the switch, so code running in a
+ * coroutine reads errno through this instead.
+ */
+int co_errno(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* COROUTINE_H */
@@ -0,0 +1,191 @@
+/*
+ * history_mmap.c
+ *
+ * Streams aesdchar history from the driver's read-only mapping, following
+ * the seq/tail protocol described in aesd_mmap.h.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "aesd_mmap.h"
+#include "history_mmap.h"
+
+#define HM_MAX_REMAPS 4
+
+typedef struct
+{
+    uint64_t start;
+    uint64_t tail;
+    uint64_t head;
+    uint32_t flags;
+} hm_snapshot_t;
+
+static uint64_t hm_load(const uint64_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static void hm_snapshot(const struct aesd_mmap_header *hdr, hm_snapshot_t *snap)
+{
+    uint32_t seq;
+
+    for (;;)
+    {
+        seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1)
+        {
+            continue;
+        }
+        snap->start = hm_load(&hdr->start);
+        snap->tail = hm_load(&hdr->tail);
+        snap->head = hm_load(&hdr->head);
+        snap->flags = __atomic_load_n(&hdr->flags, __ATOMIC_ACQUIRE);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq)
+        {
+            return;
+        }
+    }
+}
+
+/* Map the whole area of fd, or return NULL if fd has none */
+static struct aesd_mmap_header *hm_map(int fd, size_t *size)
+{
+    long page = sysconf(_SC_PAGESIZE);
+    struct aesd_mmap_header *hdr;
+    size_t area_size;
+    struct stat st;
+
+    /* Only the device has the header; a regular file might be shorter than a page */
+    if (fstat(fd, &st) != 0 || !S_ISCHR(st.st_mode))
+    {
+        return NULL;
+    }
+    hdr = mmap(NULL, page, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+    {
+        return NULL;
+    }
+    if (hdr->magic != AESD_MMAP_MAGIC || hdr->version != AESD_MMAP_VERSION)
+    {
+        munmap(hdr, page);
+        return NULL;
+    }
+    area_size = hdr->area_size;
+    munmap(hdr, page);
+
+    hdr = mmap(NULL, area_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+    {
+        return NULL;
+    }
+    *size = area_size;
+    return hdr;
+}
+
+/* Stream from file position fpos to the end with read(). */
+static int hm_stream_read(int fd, off_t fpos, char *chunk, size_t chunk_size, hs_chunk_fn fn, void *arg)
+{
+    ssize_t n;
+
+    if (lseek(fd, fpos, SEEK_SET) < 0)
+    {
+        return -1;
+    }
+    while ((n = read(fd, chunk, chunk_size)) > 0)
+    {
+        if (fn(chunk, n, arg) != 0)
+        {
+            return -1;
+        }
+    }
+    return n == 0 ? 0 : -1;
+}
+
+int hm_stream(int fd, size_t chunk_size, hs_chunk_fn fn, void *arg)
+{
+    struct aesd_mmap_header *hdr = NULL;
+    size_t area_size = 0;
+    hm_snapshot_t snap;
+    const char *data;
+    uint64_t mask, pos, tail;
+    int remaps = 0;
+    int ret = 0;
+    char *chunk = malloc(chunk_size);
+
+    if (!chunk)
+    {
+        return -1;
+    }
+
+    /* Map until we hold a current area that still has file position 0 in its data ring */
+    for (;;)
+    {
+        hdr = hm_map(fd, &area_size);
+        if (!hdr)
+        {
+            break;
+        }
+        hm_snapshot(hdr, &snap);
+        if (!(snap.flags & AESD_MMAP_STALE) && snap.tail == snap.start)
+        {
+            break;
+        }
+        munmap(hdr, area_size);
+        hdr = NULL;
+        if ((snap.flags & AESD_MMAP_STALE) == 0 || ++remaps >= HM_MAX_REMAPS)
+        {
+            break;
+        }
+    }
+    if (!hdr)
+    {
+        ret = hm_stream_read(fd, 0, chunk, chunk_size, fn, arg);
+        free(chunk);
+        return ret;
+    }
+
+    data = (const char *)hdr + hdr->data_offset;
+    mask = hdr->data_size - 1;
+    pos = snap.start;
+    while (pos < snap.head)
+    {
+        size_t n = snap.head - pos;
+        size_t at = pos & mask;
+        if (n > chunk_size)
+        {
+            n = chunk_size;
+        }
+        if (n > mask + 1 - at)
+        {
+            n = mask + 1 - at;
+        }
+        memcpy(chunk, data + at, n);
+
+        /* The copy is good unless a writer moved tail past it meanwhile */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        tail = hm_load(&hdr->tail);
+        if (tail > pos)
+        {
+            hm_snapshot(hdr, &snap);
+            ret = hm_stream_read(fd, pos > snap.start ? (off_t)(pos - snap.start) : 0,
+                                 chunk, chunk_size, fn, arg);
+            break;
+        }
+        if (fn(chunk, n, arg) != 0)
+        {
+            ret = -1;
+            break;
+        }
+        pos += n;
+    }
+
+    munmap(hdr, area_size);
+    free(chunk);
+    return ret;
+}
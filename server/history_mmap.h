@@ -0,0 +1,27 @@
+#ifndef HISTORY_MMAP_H
+#define HISTORY_MMAP_H
+
+#include "history_store.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Reader for the aesdchar history mapping (see aesd_mmap.h).
+ *
+ * The history is copied straight out of the mapped data ring, with no
+ * syscall per chunk.  Falls back to read() when the device can't be mapped,
+ * when the mapping doesn't reach back to file position 0, or from the point
+ * where writers overtake the reader.
+ */
+
+/* Pass the history of the open device fd, from file position 0, to fn in chunks of up to
+   chunk_size bytes. Returns 0 on success, -1 on failure. */
+int hm_stream(int fd, size_t chunk_size, hs_chunk_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTORY_MMAP_H */
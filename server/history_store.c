@@ -0,0 +1,729 @@
+/*
+ * history_store.c
+ *
+ * Block compressed, append-only history file with an in-memory block index,
+ * and a journal of the unsealed tail block beside it.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "history_store.h"
+#include "lz4block.h"
+
+#define HS_ENCODED_MAX (HS_HEADER_SIZE + LZ4B_BOUND(HS_BLOCK_SIZE))
+#define HS_JOURNAL_SUFFIX ".tail"
+#define HS_IMPORT_SUFFIX ".import"
+#define HS_LEGACY_SUFFIX ".legacy"
+#define HS_JOURNAL_HEADER 8      /* file offset the tail block will be sealed at */
+#define HS_RECORD_HEADER_MAX 10  /* journal record: varint raw_len, varint comp_len (0: stored) */
+#define HS_RECORD_MAX (HS_RECORD_HEADER_MAX + LZ4B_BOUND(HS_BLOCK_SIZE))
+
+typedef struct
+{
+    off_t offset;           /* of the block header in the file */
+    uint32_t raw_len;
+    uint32_t comp_len;
+} hs_block_t;
+
+struct history_store
+{
+    pthread_mutex_t mutex;
+    int fd;
+    int journal_fd;
+    char *journal_path;
+    off_t journal_len;      /* header and records */
+    lz4b_stream_t *stream;  /* what the tail's records may refer back to */
+    char *record;           /* one journal record, HS_RECORD_MAX bytes */
+    uint64_t journal_bytes; /* written since open */
+    off_t file_end;
+    hs_block_t *blocks;
+    size_t nblocks;
+    size_t blocks_cap;
+    char *tail;             /* unsealed block, HS_BLOCK_SIZE bytes */
+    size_t tail_len;
+    uint64_t raw_bytes;     /* sealed, before compression */
+};
+
+static void hs_put32(char *p, uint32_t v)
+{
+    p[0] = (char)(v & 0xff);
+    p[1] = (char)((v >> 8) & 0xff);
+    p[2] = (char)((v >> 16) & 0xff);
+    p[3] = (char)(v >> 24);
+}
+
+static uint32_t hs_get32(const char *p)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    return (uint32_t)u[0] | ((uint32_t)u[1] << 8) | ((uint32_t)u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static void hs_put64(char *p, uint64_t v)
+{
+    hs_put32(p, (uint32_t)v);
+    hs_put32(p + 4, (uint32_t)(v >> 32));
+}
+
+static uint64_t hs_get64(const char *p)
+{
+    return (uint64_t)hs_get32(p) | ((uint64_t)hs_get32(p + 4) << 32);
+}
+
+/* LEB128, at most 5 bytes for 32 bits */
+static size_t hs_put_varint(char *p, uint32_t v)
+{
+    size_t n = 0;
+    while (v >= 0x80)
+    {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+    return n;
+}
+
+/* Returns the bytes used, or 0 if p holds no complete varint before end. */
+static size_t hs_get_varint(const char *p, const char *end, uint32_t *v)
+{
+    *v = 0;
+    for (size_t n = 0; n < 5 && p + n < end; n++)
+    {
+        *v |= (uint32_t)((unsigned char)p[n] & 0x7f) << (7 * n);
+        if (!((unsigned char)p[n] & 0x80))
+        {
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+static int hs_pread_full(int fd, char *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int hs_pwrite_full(int fd, const char *buf, size_t len, off_t offset)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+    return 0;
+}
+
+static int hs_index_add(history_store_t *hs, off_t offset, uint32_t raw_len, uint32_t comp_len)
+{
+    if (hs->nblocks == hs->blocks_cap)
+    {
+        size_t cap = hs->blocks_cap ? hs->blocks_cap * 2 : 64;
+        hs_block_t *grown = realloc(hs->blocks, cap * sizeof(*grown));
+        if (!grown)
+        {
+            return -1;
+        }
+        hs->blocks = grown;
+        hs->blocks_cap = cap;
+    }
+    hs->blocks[hs->nblocks++] = (hs_block_t){ .offset = offset, .raw_len = raw_len, .comp_len = comp_len };
+    return 0;
+}
+
+/*
+ * True if the avail bytes at header, the last in the file, are the start of a
+ * block whose write was cut short.
+ */
+static int hs_torn_block(const char *header, off_t avail)
+{
+    char magic[4];
+
+    hs_put32(magic, HS_BLOCK_MAGIC);
+    if (avail < HS_HEADER_SIZE)
+    {
+        return memcmp(header, magic, avail < 4 ? (size_t)avail : 4) == 0;
+    }
+    return hs_get32(header) == HS_BLOCK_MAGIC && hs_get32(header + 4) <= HS_BLOCK_SIZE &&
+           hs_get32(header + 8) <= LZ4B_BOUND(hs_get32(header + 4));
+}
+
+/* File offset the journal's tail block is to be sealed at, or -1 if it holds no tail. */
+static off_t hs_journal_offset(history_store_t *hs)
+{
+    char header[HS_JOURNAL_HEADER];
+    struct stat st;
+
+    if (fstat(hs->journal_fd, &st) != 0 || st.st_size <= HS_JOURNAL_HEADER ||
+        hs_pread_full(hs->journal_fd, header, HS_JOURNAL_HEADER, 0) != 0)
+    {
+        return -1;
+    }
+    return (off_t)hs_get64(header);
+}
+
+/*
+ * Convert a plain text history from before the store into blocks.  The
+ * blocks are written to <path>.import and renamed over path, and the original
+ * is kept as <path>.legacy, so a crash at any point leaves the text in place.
+ */
+static int hs_import(history_store_t *hs, const char *path, off_t size)
+{
+    char *import_path = malloc(strlen(path) + sizeof(HS_IMPORT_SUFFIX));
+    char *legacy_path = malloc(strlen(path) + sizeof(HS_LEGACY_SUFFIX));
+    char *raw = malloc(HS_BLOCK_SIZE);
+    char *encoded = malloc(HS_ENCODED_MAX);
+    struct stat st, legacy_st;
+    off_t offset = 0;
+    int fd = -1;
+    int ret = -1;
+
+    if (!import_path || !legacy_path || !raw || !encoded)
+    {
+        goto out;
+    }
+    sprintf(import_path, "%s%s", path, HS_IMPORT_SUFFIX);
+    sprintf(legacy_path, "%s%s", path, HS_LEGACY_SUFFIX);
+
+    /* A previous import may have linked the original already */
+    if (link(path, legacy_path) != 0 &&
+        (errno != EEXIST || fstat(hs->fd, &st) != 0 || stat(legacy_path, &legacy_st) != 0 ||
+         st.st_ino != legacy_st.st_ino || st.st_dev != legacy_st.st_dev))
+    {
+        syslog(LOG_ERR, "history: cannot keep %s as %s: %s", path, legacy_path,
+               errno == EEXIST ? "a different file is in the way" : strerror(errno));
+        goto out;
+    }
+
+    fd = open(import_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        goto out;
+    }
+    hs->nblocks = 0;
+    hs->raw_bytes = 0;
+    hs->file_end = 0;
+    while (offset < size)
+    {
+        size_t raw_len = size - offset < HS_BLOCK_SIZE ? (size_t)(size - offset) : HS_BLOCK_SIZE;
+        size_t encoded_len;
+
+        if (hs_pread_full(hs->fd, raw, raw_len, offset) != 0)
+        {
+            goto out;
+        }
+        encoded_len = hs_encode_block(raw, raw_len, encoded);
+        if (hs_pwrite_full(fd, encoded, encoded_len, hs->file_end) != 0 ||
+            hs_index_add(hs, hs->file_end, (uint32_t)raw_len, (uint32_t)(encoded_len - HS_HEADER_SIZE)) != 0)
+        {
+            goto out;
+        }
+        hs->file_end += (off_t)encoded_len;
+        hs->raw_bytes += raw_len;
+        offset += (off_t)raw_len;
+    }
+    if (fsync(fd) != 0 || rename(import_path, path) != 0)
+    {
+        goto out;
+    }
+    close(hs->fd);
+    hs->fd = fd;
+    fd = -1;
+    syslog(LOG_INFO, "history: imported %lld bytes of plain text history, the original is kept as %s",
+           (long long)size, legacy_path);
+    ret = 0;
+
+out:
+    if (fd >= 0)
+    {
+        close(fd);
+        unlink(import_path);
+    }
+    free(encoded);
+    free(raw);
+    free(legacy_path);
+    free(import_path);
+    return ret;
+}
+
+/*
+ * Rebuild the block index.  Only a block cut short at the end of the file is
+ * dropped, and only while the journal still holds its bytes: that is a seal
+ * interrupted by a crash.  A file that does not start with a block is plain
+ * text history from before the store and is imported.  Any other bytes that
+ * are not blocks fail the open and are left for the operator.
+ */
+static int hs_load_index(history_store_t *hs, const char *path)
+{
+    off_t size = lseek(hs->fd, 0, SEEK_END);
+    off_t offset = 0;
+    char header[HS_HEADER_SIZE];
+
+    if (size < 0)
+    {
+        return -1;
+    }
+    while (offset < size)
+    {
+        off_t avail = size - offset < HS_HEADER_SIZE ? size - offset : HS_HEADER_SIZE;
+        if (hs_pread_full(hs->fd, header, (size_t)avail, offset) != 0)
+        {
+            return -1;
+        }
+        uint32_t raw_len = hs_get32(header + 4);
+        uint32_t comp_len = hs_get32(header + 8);
+        if (avail < HS_HEADER_SIZE || hs_get32(header) != HS_BLOCK_MAGIC || raw_len > HS_BLOCK_SIZE ||
+            comp_len > LZ4B_BOUND(raw_len) || offset + HS_HEADER_SIZE + (off_t)comp_len > size)
+        {
+            break;
+        }
+        if (hs_index_add(hs, offset, raw_len, comp_len) != 0)
+        {
+            return -1;
+        }
+        hs->raw_bytes += raw_len;
+        offset += HS_HEADER_SIZE + comp_len;
+    }
+    hs->file_end = offset;
+    if (offset == size)
+    {
+        return 0;
+    }
+
+    if (hs_torn_block(header, size - offset) && hs_journal_offset(hs) == offset)
+    {
+        syslog(LOG_WARNING, "history: dropping %lld bytes of a block whose write was interrupted",
+               (long long)(size - offset));
+        return ftruncate(hs->fd, offset);
+    }
+    if (offset == 0)
+    {
+        return hs_import(hs, path, size);
+    }
+    syslog(LOG_ERR, "history: %s holds %lld bytes that are not a block at offset %lld; "
+           "move it aside to start a new history", path, (long long)(size - offset), (long long)offset);
+    return -1;
+}
+
+/* Empty the journal for a tail block starting at file_end. */
+static int hs_journal_reset(history_store_t *hs)
+{
+    char header[HS_JOURNAL_HEADER];
+
+    hs_put64(header, (uint64_t)hs->file_end);
+    if (hs_pwrite_full(hs->journal_fd, header, HS_JOURNAL_HEADER, 0) != 0)
+    {
+        return -1;
+    }
+    hs->journal_len = HS_JOURNAL_HEADER;
+    lz4b_stream_reset(hs->stream);
+    return ftruncate(hs->journal_fd, HS_JOURNAL_HEADER);
+}
+
+/*
+ * Decode the journal's records into the tail.  A record cut short by a crash
+ * belongs to an append that never returned, and is dropped.
+ */
+static void hs_journal_replay(history_store_t *hs, const char *records, size_t len)
+{
+    const char *p = records;
+    const char *end = records + len;
+
+    while (p < end)
+    {
+        uint32_t raw_len, comp_len;
+        size_t n = hs_get_varint(p, end, &raw_len);
+        size_t m = n ? hs_get_varint(p + n, end, &comp_len) : 0;
+        if (!m || raw_len == 0 || raw_len > HS_BLOCK_SIZE - hs->tail_len)
+        {
+            break;
+        }
+        const char *payload = p + n + m;
+        size_t payload_len = comp_len ? comp_len : raw_len;
+        if ((size_t)(end - payload) < payload_len)
+        {
+            break;
+        }
+        if (!comp_len)
+        {
+            memcpy(hs->tail + hs->tail_len, payload, raw_len);
+        }
+        else if (lz4b_decompress_next(payload, comp_len, hs->tail, hs->tail_len, raw_len) != (long)raw_len)
+        {
+            break;
+        }
+        hs->tail_len += raw_len;
+        p = payload + payload_len;
+    }
+    hs->journal_len = HS_JOURNAL_HEADER + (off_t)(p - records);
+    lz4b_stream_load(hs->stream, hs->tail, 0, hs->tail_len);
+    if (p != end)
+    {
+        syslog(LOG_WARNING, "history: dropping %zu bytes of an interrupted append from %s",
+               (size_t)(end - p), hs->journal_path);
+    }
+}
+
+/*
+ * Reload the tail from the journal.  A journal whose header does not match
+ * file_end belongs to a block that was sealed before a crash emptied it, or
+ * to a store that is gone, and is dropped.
+ */
+static int hs_journal_recover(history_store_t *hs)
+{
+    struct stat st;
+
+    if (fstat(hs->journal_fd, &st) != 0)
+    {
+        return -1;
+    }
+    if (hs_journal_offset(hs) != hs->file_end)
+    {
+        return hs_journal_reset(hs);
+    }
+
+    size_t len = (size_t)(st.st_size - HS_JOURNAL_HEADER);
+    char *records = malloc(len);
+    if (!records || hs_pread_full(hs->journal_fd, records, len, HS_JOURNAL_HEADER) != 0)
+    {
+        free(records);
+        return -1;
+    }
+    hs_journal_replay(hs, records, len);
+    free(records);
+    if (ftruncate(hs->journal_fd, hs->journal_len) != 0)
+    {
+        return -1;
+    }
+    syslog(LOG_INFO, "history: recovered %zu unsealed bytes from %s", hs->tail_len, hs->journal_path);
+    return 0;
+}
+
+/*
+ * Journal the len bytes just placed at the end of the tail, compressed against
+ * the tail before them.  Called with mutex held.
+ */
+static int hs_journal_append(history_store_t *hs, size_t len)
+{
+    char header[HS_RECORD_HEADER_MAX];
+    const char *payload = hs->record + HS_RECORD_HEADER_MAX;
+    size_t header_len, payload_len;
+    size_t comp_len = lz4b_compress_next(hs->stream, hs->tail, hs->tail_len, len,
+                                         hs->record + HS_RECORD_HEADER_MAX, LZ4B_BOUND(len));
+
+    if (comp_len == 0 || comp_len >= len)
+    {
+        /* Incompressible: store as is, marked by a compressed length of 0 */
+        payload = hs->tail + hs->tail_len;
+        comp_len = 0;
+    }
+    header_len = hs_put_varint(header, (uint32_t)len);
+    header_len += hs_put_varint(header + header_len, (uint32_t)comp_len);
+    payload_len = comp_len ? comp_len : len;
+
+    /* Header and payload in one write, so a record is torn only by a crash */
+    memmove(hs->record + header_len, payload, payload_len);
+    memcpy(hs->record, header, header_len);
+    if (hs_pwrite_full(hs->journal_fd, hs->record, header_len + payload_len, hs->journal_len) != 0)
+    {
+        /* Don't leave part of it for a later, shorter record to expose */
+        if (ftruncate(hs->journal_fd, hs->journal_len) != 0)
+        {
+            syslog(LOG_ERR, "history: cannot trim %s: %s", hs->journal_path, strerror(errno));
+        }
+        return -1;
+    }
+    hs->journal_len += (off_t)(header_len + payload_len);
+    hs->journal_bytes += header_len + payload_len;
+    return 0;
+}
+
+size_t hs_encode_block(const char *raw, size_t raw_len, char *out)
+{
+    size_t comp_len = lz4b_compress(raw, raw_len, out + HS_HEADER_SIZE, LZ4B_BOUND(raw_len));
+    if (comp_len == 0 || comp_len >= raw_len)
+    {
+        /* Incompressible: store as is */
+        memcpy(out + HS_HEADER_SIZE, raw, raw_len);
+        comp_len = raw_len;
+    }
+    hs_put32(out, HS_BLOCK_MAGIC);
+    hs_put32(out + 4, (uint32_t)raw_len);
+    hs_put32(out + 8, (uint32_t)comp_len);
+    return HS_HEADER_SIZE + comp_len;
+}
+
+/* Compress the tail and append it to the file. Called with mutex held. */
+static int hs_seal(history_store_t *hs)
+{
+    if (hs->tail_len == 0)
+    {
+        return 0;
+    }
+
+    char *encoded = malloc(HS_ENCODED_MAX);
+    if (!encoded)
+    {
+        return -1;
+    }
+    size_t encoded_len = hs_encode_block(hs->tail, hs->tail_len, encoded);
+    int ret = hs_pwrite_full(hs->fd, encoded, encoded_len, hs->file_end);
+    if (ret == 0) ret = hs_index_add(hs, hs->file_end, (uint32_t)hs->tail_len,
+                                     (uint32_t)(encoded_len - HS_HEADER_SIZE));
+    if (ret == 0)
+    {
+        hs->file_end += (off_t)encoded_len;
+        hs->raw_bytes += hs->tail_len;
+        hs->tail_len = 0;
+        /* A crash before this leaves a journal for the old file_end, which hs_open drops */
+        ret = hs_journal_reset(hs);
+    }
+    free(encoded);
+    return ret;
+}
+
+history_store_t *hs_open(const char *path)
+{
+    history_store_t *hs = calloc(1, sizeof(*hs));
+    if (!hs)
+    {
+        return NULL;
+    }
+    hs->journal_fd = -1;
+    hs->tail = malloc(HS_BLOCK_SIZE);
+    hs->stream = malloc(sizeof(*hs->stream));
+    hs->record = malloc(HS_RECORD_MAX);
+    hs->journal_path = malloc(strlen(path) + sizeof(HS_JOURNAL_SUFFIX));
+    if (hs->journal_path)
+    {
+        sprintf(hs->journal_path, "%s%s", path, HS_JOURNAL_SUFFIX);
+    }
+    hs->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (hs->journal_path)
+    {
+        hs->journal_fd = open(hs->journal_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (!hs->tail || !hs->stream || !hs->record || hs->fd < 0 || hs->journal_fd < 0 || hs_load_index(hs, path) != 0 ||
+        hs_journal_recover(hs) != 0 || (hs->tail_len == HS_BLOCK_SIZE && hs_seal(hs) != 0))
+    {
+        if (hs->fd >= 0)
+        {
+            close(hs->fd);
+        }
+        if (hs->journal_fd >= 0)
+        {
+            close(hs->journal_fd);
+        }
+        free(hs->journal_path);
+        free(hs->record);
+        free(hs->stream);
+        free(hs->tail);
+        free(hs->blocks);
+        free(hs);
+        return NULL;
+    }
+    pthread_mutex_init(&hs->mutex, NULL);
+    return hs;
+}
+
+void hs_close(history_store_t *hs)
+{
+    if (!hs)
+    {
+        return;
+    }
+    pthread_mutex_lock(&hs->mutex);
+    if (hs_seal(hs) != 0)
+    {
+        syslog(LOG_ERR, "history: failed to write final block: %s", strerror(errno));
+    }
+    else
+    {
+        unlink(hs->journal_path);
+    }
+    syslog(LOG_INFO, "history: %llu bytes stored in %lld (%zu blocks), %llu bytes journaled",
+           (unsigned long long)hs->raw_bytes, (long long)hs->file_end, hs->nblocks,
+           (unsigned long long)hs->journal_bytes);
+    pthread_mutex_unlock(&hs->mutex);
+
+    pthread_mutex_destroy(&hs->mutex);
+    close(hs->fd);
+    close(hs->journal_fd);
+    free(hs->journal_path);
+    free(hs->record);
+    free(hs->stream);
+    free(hs->tail);
+    free(hs->blocks);
+    free(hs);
+}
+
+/*
+ * Every packet reaches the journal before hs_append returns, so a reply built
+ * from the tail never shows bytes a crash could lose.  It is journaled LZ4
+ * compressed against the tail before it, so repetitive history costs the
+ * journal a fraction of its size rather than a second raw copy.
+ */
+int hs_append(history_store_t *hs, const char *data, size_t len)
+{
+    int ret = 0;
+    pthread_mutex_lock(&hs->mutex);
+    while (len > 0 && ret == 0)
+    {
+        size_t n = HS_BLOCK_SIZE - hs->tail_len;
+        if (n > len)
+        {
+            n = len;
+        }
+        memcpy(hs->tail + hs->tail_len, data, n);
+        ret = hs_journal_append(hs, n);
+        if (ret != 0)
+        {
+            break;
+        }
+        hs->tail_len += n;
+        data += n;
+        len -= n;
+        if (hs->tail_len == HS_BLOCK_SIZE)
+        {
+            ret = hs_seal(hs);
+        }
+    }
+    pthread_mutex_unlock(&hs->mutex);
+    return ret;
+}
+
+/*
+ * Copy the block index and tail so the caller can stream without holding the
+ * mutex; sealed blocks in the file never change.
+ */
+static int hs_snapshot(history_store_t *hs, hs_block_t **blocks, size_t *nblocks, char **tail, size_t *tail_len)
+{
+    pthread_mutex_lock(&hs->mutex);
+    *nblocks = hs->nblocks;
+    *tail_len = hs->tail_len;
+    *blocks = malloc((hs->nblocks ? hs->nblocks : 1) * sizeof(**blocks));
+    *tail = malloc(hs->tail_len ? hs->tail_len : 1);
+    if (*blocks && *tail)
+    {
+        if (hs->nblocks)
+        {
+            memcpy(*blocks, hs->blocks, hs->nblocks * sizeof(**blocks));
+        }
+        memcpy(*tail, hs->tail, hs->tail_len);
+    }
+    pthread_mutex_unlock(&hs->mutex);
+
+    if (!*blocks || !*tail)
+    {
+        free(*blocks);
+        free(*tail);
+        return -1;
+    }
+    return 0;
+}
+
+static int hs_stream(history_store_t *hs, int encoded, hs_chunk_fn fn, void *arg)
+{
+    hs_block_t *blocks;
+    size_t nblocks, tail_len;
+    char *tail;
+    if (hs_snapshot(hs, &blocks, &nblocks, &tail, &tail_len) != 0)
+    {
+        return -1;
+    }
+
+    int ret = 0;
+    char *stored = malloc(HS_ENCODED_MAX);
+    char *raw = malloc(HS_BLOCK_SIZE);
+    if (!stored || !raw)
+    {
+        ret = -1;
+    }
+
+    for (size_t i = 0; i < nblocks && ret == 0; i++)
+    {
+        const hs_block_t *b = &blocks[i];
+        size_t stored_len = HS_HEADER_SIZE + b->comp_len;
+        if (hs_pread_full(hs->fd, stored, stored_len, b->offset) != 0)
+        {
+            ret = -1;
+        }
+        else if (encoded)
+        {
+            ret = fn(stored, stored_len, arg) ? -1 : 0;
+        }
+        else if (b->comp_len == b->raw_len)
+        {
+            ret = fn(stored + HS_HEADER_SIZE, b->raw_len, arg) ? -1 : 0;
+        }
+        else if (lz4b_decompress(stored + HS_HEADER_SIZE, b->comp_len, raw, HS_BLOCK_SIZE) != (long)b->raw_len)
+        {
+            syslog(LOG_ERR, "history: corrupt block at offset %lld", (long long)b->offset);
+            ret = -1;
+        }
+        else
+        {
+            ret = fn(raw, b->raw_len, arg) ? -1 : 0;
+        }
+    }
+
+    if (ret == 0 && tail_len > 0)
+    {
+        if (encoded)
+        {
+            ret = fn(stored, hs_encode_block(tail, tail_len, stored), arg) ? -1 : 0;
+        }
+        else
+        {
+            ret = fn(tail, tail_len, arg) ? -1 : 0;
+        }
+    }
+
+    free(raw);
+    free(stored);
+    free(tail);
+    free(blocks);
+    return ret;
+}
+
+int hs_read(history_store_t *hs, hs_chunk_fn fn, void *arg)
+{
+    return hs_stream(hs, 0, fn, arg);
+}
+
+int hs_read_blocks(history_store_t *hs, hs_chunk_fn fn, void *arg)
+{
+    return hs_stream(hs, 1, fn, arg);
+}
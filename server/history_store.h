@@ -0,0 +1,65 @@
+#ifndef HISTORY_STORE_H
+#define HISTORY_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Compressed history file for the file backend.
+ *
+ * Packets are appended to an in-memory tail block and to a journal at
+ * <path>.tail, so a packet survives a crash once hs_append has returned.
+ * Each journal record is LZ4 compressed against the tail bytes before it,
+ * and a torn last record is dropped on recovery.  Once the tail holds HS_BLOCK_SIZE bytes (or the store is
+ * closed) it is compressed and appended to the file, the journal is emptied,
+ * and hs_open reloads whatever the journal still holds.  The file is a plain
+ * sequence of blocks:
+ *
+ *   uint32_t magic;      HS_BLOCK_MAGIC, little endian
+ *   uint32_t raw_len;    uncompressed bytes, at most HS_BLOCK_SIZE
+ *   uint32_t comp_len;   payload bytes; equal to raw_len when stored uncompressed
+ *   payload              LZ4 block format (see lz4block.h)
+ *
+ * The same block layout is used on the wire for clients that ask for a
+ * compressed reply.  The block index is kept in memory and rebuilt from the
+ * headers when the file is opened.  A file that does not start with a block
+ * is taken for a plain text history from before the store: it is imported
+ * and the original kept as <path>.legacy.  A file with bad blocks further in
+ * is not opened, and not modified.
+ */
+
+#define HS_BLOCK_MAGIC 0x31424841u   /* "AHB1" */
+#define HS_BLOCK_SIZE (64 * 1024)
+#define HS_HEADER_SIZE 12
+
+typedef struct history_store history_store_t;
+
+/* Receives consecutive chunks of history. Return non-zero to stop; the stream then fails with -1. */
+typedef int (*hs_chunk_fn)(const char *data, size_t len, void *arg);
+
+/* Open/close. Existing blocks and journaled tail in path are kept; close seals the tail block.
+ * hs_open returns NULL if path holds data it does not recognise. */
+history_store_t *hs_open(const char *path);
+void hs_close(history_store_t *hs);
+
+/* Append a packet. Returns 0 on success, -1 on failure. */
+int hs_append(history_store_t *hs, const char *data, size_t len);
+
+/* Stream the whole history, decompressed. Returns 0 on success, -1 on failure. */
+int hs_read(history_store_t *hs, hs_chunk_fn fn, void *arg);
+
+/* Stream the whole history as encoded blocks (header + payload). Returns 0 on success, -1 on failure. */
+int hs_read_blocks(history_store_t *hs, hs_chunk_fn fn, void *arg);
+
+/* Encode up to HS_BLOCK_SIZE raw bytes as one block into out (HS_HEADER_SIZE + LZ4B_BOUND(raw_len) bytes). Returns the block size. */
+size_t hs_encode_block(const char *raw, size_t raw_len, char *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HISTORY_STORE_H */
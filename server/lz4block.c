@@ -0,0 +1,266 @@
+/*
+ * lz4block.c
+ *
+ * Greedy single-pass LZ4 block compressor and bounds-checked decompressor,
+ * for whole buffers or for a buffer that grows a block at a time.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz4block.h"
+
+#define LZ4B_MINMATCH 4
+#define LZ4B_LASTLITERALS 5     /* the last 5 bytes are always literals */
+#define LZ4B_MFLIMIT 12         /* no match may start in the last 12 bytes */
+#define LZ4B_MAX_OFFSET 65535
+
+static uint32_t lz4b_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t lz4b_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ4B_HASH_BITS);
+}
+
+/* Write a 4 bit length field's overflow as a run of 255s plus remainder. */
+static uint8_t *lz4b_put_length(uint8_t *op, const uint8_t *oend, size_t len)
+{
+    while (len >= 255)
+    {
+        if (op >= oend)
+        {
+            return NULL;
+        }
+        *op++ = 255;
+        len -= 255;
+    }
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *lz4b_put_sequence(uint8_t *op, const uint8_t *oend, const uint8_t *lit, size_t lit_len,
+                                  size_t offset, size_t match_len)
+{
+    if (op >= oend)
+    {
+        return NULL;
+    }
+    uint8_t *token = op++;
+    *token = (uint8_t)((lit_len >= 15 ? 15 : lit_len) << 4);
+    if (lit_len >= 15 && !(op = lz4b_put_length(op, oend, lit_len - 15)))
+    {
+        return NULL;
+    }
+    if ((size_t)(oend - op) < lit_len)
+    {
+        return NULL;
+    }
+    memcpy(op, lit, lit_len);
+    op += lit_len;
+
+    if (!match_len)
+    {
+        return op;  /* last sequence: literals only */
+    }
+
+    if (oend - op < 2)
+    {
+        return NULL;
+    }
+    *op++ = (uint8_t)(offset & 0xff);
+    *op++ = (uint8_t)(offset >> 8);
+    match_len -= LZ4B_MINMATCH;
+    *token |= (uint8_t)(match_len >= 15 ? 15 : match_len);
+    if (match_len >= 15 && !(op = lz4b_put_length(op, oend, match_len - 15)))
+    {
+        return NULL;
+    }
+    return op;
+}
+
+void lz4b_stream_reset(lz4b_stream_t *stream)
+{
+    memset(stream->table, 0, sizeof(stream->table));
+}
+
+void lz4b_stream_load(lz4b_stream_t *stream, const char *base, size_t from, size_t to)
+{
+    const uint8_t *b = (const uint8_t *)base;
+    for (size_t i = from; i + LZ4B_MINMATCH <= to; i++)
+    {
+        stream->table[lz4b_hash(lz4b_read32(b + i))] = (uint32_t)i;
+    }
+}
+
+size_t lz4b_compress_next(lz4b_stream_t *stream, const char *base, size_t pos, size_t len,
+                          char *dst, size_t dst_cap)
+{
+    const uint8_t *b = (const uint8_t *)base;
+    const uint8_t *anchor = b + pos;
+    uint8_t *op = (uint8_t *)dst;
+    const uint8_t *oend = op + dst_cap;
+    uint32_t *table = stream->table;
+    size_t end = pos + len;
+    size_t ip = pos;
+
+    if (len > LZ4B_MFLIMIT)
+    {
+        size_t limit = end - LZ4B_MFLIMIT;
+        size_t match_limit = end - LZ4B_LASTLITERALS;
+
+        while (ip < limit)
+        {
+            uint32_t seq = lz4b_read32(b + ip);
+            uint32_t h = lz4b_hash(seq);
+            size_t ref = table[h];
+            table[h] = (uint32_t)ip;
+            if (ref >= ip || ip - ref > LZ4B_MAX_OFFSET || lz4b_read32(b + ref) != seq)
+            {
+                ip++;
+                continue;
+            }
+
+            size_t match_len = LZ4B_MINMATCH;
+            while (ip + match_len < match_limit && b[ref + match_len] == b[ip + match_len])
+            {
+                match_len++;
+            }
+
+            op = lz4b_put_sequence(op, oend, anchor, (size_t)(b + ip - anchor), ip - ref, match_len);
+            if (!op)
+            {
+                break;
+            }
+            ip += match_len;
+            anchor = b + ip;
+        }
+    }
+
+    /* The positions no match could start at are still good to refer back to */
+    lz4b_stream_load(stream, base, ip, end);
+    if (op)
+    {
+        op = lz4b_put_sequence(op, oend, anchor, (size_t)(b + end - anchor), 0, 0);
+    }
+    if (!op)
+    {
+        return 0;
+    }
+    return (size_t)(op - (uint8_t *)dst);
+}
+
+size_t lz4b_compress(const char *src, size_t src_len, char *dst, size_t dst_cap)
+{
+    /* Heap allocated: this may run on a small coroutine stack */
+    lz4b_stream_t *stream = calloc(1, sizeof(*stream));
+    if (!stream)
+    {
+        return 0;
+    }
+    size_t comp_len = lz4b_compress_next(stream, src, 0, src_len, dst, dst_cap);
+    free(stream);
+    return comp_len;
+}
+
+long lz4b_decompress(const char *src, size_t src_len, char *dst, size_t dst_cap)
+{
+    return lz4b_decompress_next(src, src_len, dst, 0, dst_cap);
+}
+
+long lz4b_decompress_next(const char *src, size_t src_len, char *base, size_t pos, size_t dst_cap)
+{
+    const uint8_t *ip = (const uint8_t *)src;
+    const uint8_t *iend = ip + src_len;
+    uint8_t *op = (uint8_t *)base + pos;
+    uint8_t *ostart = op;
+    uint8_t *oend = op + dst_cap;
+
+    while (ip < iend)
+    {
+        unsigned token = *ip++;
+
+        size_t lit_len = token >> 4;
+        if (lit_len == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                lit_len += b;
+            } while (b == 255);
+        }
+        if ((size_t)(iend - ip) < lit_len || (size_t)(oend - op) < lit_len)
+        {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+
+        if (ip == iend)
+        {
+            break;  /* last sequence has no match */
+        }
+
+        if (iend - ip < 2)
+        {
+            return -1;
+        }
+        size_t offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - (uint8_t *)base))
+        {
+            return -1;
+        }
+
+        size_t match_len = token & 15;
+        if (match_len == 15)
+        {
+            unsigned b;
+            do
+            {
+                if (ip >= iend)
+                {
+                    return -1;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += LZ4B_MINMATCH;
+        if ((size_t)(oend - op) < match_len)
+        {
+            return -1;
+        }
+
+        /* Byte by byte: the match may overlap the bytes being produced */
+        const uint8_t *match = op - offset;
+        if (offset >= match_len)
+        {
+            memcpy(op, match, match_len);
+            op += match_len;
+        }
+        else
+        {
+            while (match_len--)
+            {
+                *op++ = *match++;
+            }
+        }
+    }
+    return (long)(op - ostart);
+}
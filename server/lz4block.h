@@ -0,0 +1,57 @@
+#ifndef LZ4BLOCK_H
+#define LZ4BLOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Minimal codec for the LZ4 block format (no frame layer), so the server
+ * does not depend on liblz4.  Output is readable by LZ4_decompress_safe().
+ */
+
+/* Worst case compressed size for len input bytes. */
+#define LZ4B_BOUND(len) ((len) + (len) / 255 + 16)
+
+/* Returns the compressed size, or 0 if dst_cap is too small. */
+size_t lz4b_compress(const char *src, size_t src_len, char *dst, size_t dst_cap);
+
+/* Returns the decompressed size, or -1 on malformed input or if dst_cap is too small. */
+long lz4b_decompress(const char *src, size_t src_len, char *dst, size_t dst_cap);
+
+#define LZ4B_HASH_BITS 12
+
+/*
+ * Compressor state for a buffer that grows at the end, compressed a block at
+ * a time by lz4b_compress_next.  Each block may refer back up to 64 KiB into
+ * the bytes before it, like LZ4_compress_fast_continue() with the buffer as
+ * its own dictionary, so the blocks must be decompressed in order into the
+ * same buffer.
+ */
+typedef struct
+{
+    uint32_t table[1 << LZ4B_HASH_BITS];    /* positions in the buffer by hash of their 4 bytes */
+} lz4b_stream_t;
+
+/* Forget the buffer, for one that starts over at position 0. */
+void lz4b_stream_reset(lz4b_stream_t *stream);
+
+/* Make base[from, to) available to later blocks, e.g. after decompressing it. */
+void lz4b_stream_load(lz4b_stream_t *stream, const char *base, size_t from, size_t to);
+
+/* Compress base[pos, pos + len). Returns the compressed size, or 0 if dst_cap is too small. */
+size_t lz4b_compress_next(lz4b_stream_t *stream, const char *base, size_t pos, size_t len,
+                          char *dst, size_t dst_cap);
+
+/* Decompress a block from lz4b_compress_next to base + pos, with base[0, pos) as it was when it
+ * was compressed. Returns the decompressed size, or -1 on malformed input or if dst_cap is too small. */
+long lz4b_decompress_next(const char *src, size_t src_len, char *base, size_t pos, size_t dst_cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LZ4BLOCK_H */
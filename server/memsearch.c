@@ -0,0 +1,106 @@
+/*
+ * memsearch.c
+ *
+ * SIMD substring search.  Each step compares the first and last byte of the
+ * needle against 16 haystack positions at once and only runs memcmp on the
+ * positions where both match.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <string.h>
+#include "memsearch.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static const char *memsearch_sse2(const char *h, size_t n, const char *needle, size_t k)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+
+    /* Both 16 byte loads must stay inside the haystack */
+    for (; i + k - 1 + 16 <= n; i += 16)
+    {
+        __m128i block_first = _mm_loadu_si128((const __m128i *)(h + i));
+        __m128i block_last = _mm_loadu_si128((const __m128i *)(h + i + k - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last)));
+
+        while (mask)
+        {
+            unsigned bit = (unsigned)__builtin_ctz(mask);
+            if (memcmp(h + i + bit + 1, needle + 1, k - 2) == 0)
+            {
+                return h + i + bit;
+            }
+            mask &= mask - 1;
+        }
+    }
+
+    /* Fewer than 16 candidate positions left */
+    return memmem(h + i, n - i, needle, k);
+}
+#endif
+
+const char *memsearch(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len)
+{
+    if (needle_len == 0)
+    {
+        return haystack;
+    }
+    if (needle_len > haystack_len)
+    {
+        return NULL;
+    }
+    if (needle_len == 1)
+    {
+        return memchr(haystack, needle[0], haystack_len);
+    }
+#ifdef __SSE2__
+    return memsearch_sse2(haystack, haystack_len, needle, needle_len);
+#else
+    return memmem(haystack, haystack_len, needle, needle_len);
+#endif
+}
+
+size_t memsearch_entries(const char *text, size_t text_len, const char *needle, size_t needle_len,
+                         memsearch_entry_fn fn, void *arg)
+{
+    const char *end = text + text_len;
+    const char *pos = text;      /* start of the first entry not yet searched */
+    const char *counted = text;  /* entries before this point are counted in index */
+    uint32_t index = 0;
+    size_t matches = 0;
+
+    while (pos < end)
+    {
+        const char *match = memsearch(pos, end - pos, needle, needle_len);
+        if (!match)
+        {
+            break;
+        }
+
+        const char *entry = memrchr(pos, '\n', match - pos);
+        entry = entry ? entry + 1 : pos;
+        const char *nl;
+        while ((nl = memchr(counted, '\n', entry - counted)))
+        {
+            index++;
+            counted = nl + 1;
+        }
+        const char *entry_end = memchr(match, '\n', end - match);
+        entry_end = entry_end ? entry_end + 1 : end;
+
+        if (fn(index, entry, entry_end - entry, arg) != 0)
+        {
+            break;
+        }
+        matches++;
+
+        index++;
+        counted = pos = entry_end;
+    }
+    return matches;
+}
@@ -0,0 +1,33 @@
+#ifndef MEMSEARCH_H
+#define MEMSEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Find the first occurrence of needle in haystack, like memmem(3).
+ * Uses SSE2 to test 16 candidate positions per step where available.
+ * Returns a pointer to the match or NULL. An empty needle matches at haystack.
+ */
+const char *memsearch(const char *haystack, size_t haystack_len, const char *needle, size_t needle_len);
+
+/* Receives a matching entry, newline included, and its index. Return non-zero to stop. */
+typedef int (*memsearch_entry_fn)(uint32_t index, const char *entry, size_t len, void *arg);
+
+/*
+ * Pass every entry of text that contains needle to fn, in order.  Entries are
+ * newline terminated (the last may lack its newline) and numbered from 0,
+ * matching and non-matching alike.  Returns the number of entries fn accepted.
+ */
+size_t memsearch_entries(const char *text, size_t text_len, const char *needle, size_t needle_len,
+                         memsearch_entry_fn fn, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMSEARCH_H */
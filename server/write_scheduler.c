@@ -0,0 +1,605 @@
+/*
+ * write_scheduler.c
+ *
+ * Deficit round-robin scheduler for device commits with per-client queues
+ * and optional per-client token bucket rate limits.
+ *
+ * Submitters never take the scheduler mutex: they push requests into a
+ * lock-free MPSC ring, and the committer thread moves them onto the client
+ * queues it alone works on.  The mutex only guards the committer's state
+ * against ws_log_metrics and ws_set_rate_limit, and pairs with the condition
+ * variable the committer sleeps on.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <syslog.h>
+#include "write_scheduler.h"
+#include "aesd-mpsc-ring.h"
+
+#define WS_DEFAULT_QUANTUM 4096
+#define WS_KEY_MAX 64
+#define WS_HASH_BUCKETS 256
+#define WS_SWEEP_INTERVAL_NS 1000000000ULL
+#define WS_INBOX_SLOTS 4096
+#define WS_DRAIN_BATCH 64
+
+typedef struct ws_request
+{
+    char key[WS_KEY_MAX];
+    const char *data;
+    size_t len;
+    ws_done_fn done;
+    void *done_arg;
+    struct ws_request *next;
+} ws_request_t;
+
+typedef struct ws_client
+{
+    char key[WS_KEY_MAX];
+    ws_request_t *head;
+    ws_request_t *tail;
+    size_t depth;           /* queued packets */
+    size_t queued_bytes;
+    size_t deficit;
+    double tokens;          /* rate limit balance in bytes */
+    uint64_t last_refill_ns;
+    int active;
+    struct ws_client *hash_next;
+    struct ws_client *active_next;
+} ws_client_t;
+
+struct write_sched
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_t committer;
+    ws_commit_fn commit;
+    void *commit_arg;
+    size_t quantum;
+    size_t rate_bytes_per_sec;
+    size_t rate_burst;
+    atomic_int shutdown;
+
+    struct aesd_mpsc_ring inbox;    /* submitted requests not yet on a client queue */
+    atomic_int submitting;      /* submitters between their shutdown check and their push */
+    atomic_int idle;            /* committer is, or is about to be, waiting on cond */
+
+    ws_client_t *buckets[WS_HASH_BUCKETS];
+    ws_client_t *active_head;   /* clients with queued packets, in round-robin order */
+    ws_client_t *active_tail;
+    size_t active_count;
+    uint64_t last_sweep_ns;
+
+    /* Totals, reported by ws_log_metrics */
+    size_t clients;
+    size_t pending_packets;
+    size_t max_client_depth;
+    uint64_t committed_packets;
+    uint64_t committed_bytes;
+    uint64_t failed_packets;
+    uint64_t rate_limited_turns;
+};
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int complete;
+    int result;
+} ws_waiter_t;
+
+static uint64_t ws_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static size_t ws_hash(const char *key)
+{
+    /* FNV-1a */
+    uint32_t h = 2166136261u;
+    while (*key)
+    {
+        h ^= (unsigned char)*key++;
+        h *= 16777619u;
+    }
+    return h % WS_HASH_BUCKETS;
+}
+
+static ws_client_t *ws_client_get(write_sched_t *s, const char *key)
+{
+    size_t b = ws_hash(key);
+    for (ws_client_t *c = s->buckets[b]; c; c = c->hash_next)
+    {
+        if (strcmp(c->key, key) == 0)
+        {
+            return c;
+        }
+    }
+
+    ws_client_t *c = calloc(1, sizeof(*c));
+    if (!c)
+    {
+        return NULL;
+    }
+    size_t key_len = strnlen(key, WS_KEY_MAX - 1);
+    memcpy(c->key, key, key_len);
+    c->key[key_len] = '\0';
+    c->tokens = (double)s->rate_burst;
+    c->last_refill_ns = ws_now_ns();
+    c->hash_next = s->buckets[b];
+    s->buckets[b] = c;
+    s->clients++;
+    return c;
+}
+
+static void ws_client_free(write_sched_t *s, ws_client_t *victim)
+{
+    ws_client_t **pp = &s->buckets[ws_hash(victim->key)];
+    while (*pp && *pp != victim)
+    {
+        pp = &(*pp)->hash_next;
+    }
+    if (*pp)
+    {
+        *pp = victim->hash_next;
+    }
+    free(victim);
+    s->clients--;
+}
+
+static void ws_active_push(write_sched_t *s, ws_client_t *c)
+{
+    c->active_next = NULL;
+    if (s->active_tail)
+    {
+        s->active_tail->active_next = c;
+    }
+    else
+    {
+        s->active_head = c;
+    }
+    s->active_tail = c;
+}
+
+static ws_client_t *ws_active_pop(write_sched_t *s)
+{
+    ws_client_t *c = s->active_head;
+    if (!c)
+    {
+        return NULL;
+    }
+    s->active_head = c->active_next;
+    if (!s->active_head)
+    {
+        s->active_tail = NULL;
+    }
+    c->active_next = NULL;
+    return c;
+}
+
+static void ws_refill(write_sched_t *s, ws_client_t *c, uint64_t now)
+{
+    if (!s->rate_bytes_per_sec)
+    {
+        return;
+    }
+    c->tokens += (double)(now - c->last_refill_ns) * (double)s->rate_bytes_per_sec / 1e9;
+    if (c->tokens > (double)s->rate_burst)
+    {
+        c->tokens = (double)s->rate_burst;
+    }
+    c->last_refill_ns = now;
+}
+
+/* Returns 0 when the client may commit len bytes now, otherwise the ns until it may. */
+static uint64_t ws_rate_wait_ns(const write_sched_t *s, const ws_client_t *c, size_t len)
+{
+    if (!s->rate_bytes_per_sec || atomic_load(&s->shutdown))
+    {
+        return 0;
+    }
+    /* Packets larger than the burst are allowed once the bucket is full, leaving a negative balance */
+    double need = (double)(len < s->rate_burst ? len : s->rate_burst);
+    if (c->tokens >= need)
+    {
+        return 0;
+    }
+    return (uint64_t)((need - c->tokens) * 1e9 / (double)s->rate_bytes_per_sec) + 1;
+}
+
+/* Drop idle clients whose rate limit state no longer matters. Called with mutex held. */
+static void ws_sweep_idle(write_sched_t *s, uint64_t now)
+{
+    if (now - s->last_sweep_ns < WS_SWEEP_INTERVAL_NS)
+    {
+        return;
+    }
+    s->last_sweep_ns = now;
+    for (size_t b = 0; b < WS_HASH_BUCKETS; b++)
+    {
+        ws_client_t *c = s->buckets[b];
+        while (c)
+        {
+            ws_client_t *next = c->hash_next;
+            if (!c->active)
+            {
+                ws_refill(s, c, now);
+                if (c->tokens >= (double)s->rate_burst)
+                {
+                    ws_client_free(s, c);
+                }
+            }
+            c = next;
+        }
+    }
+}
+
+static void ws_commit_one(write_sched_t *s, ws_client_t *c)
+{
+    ws_request_t *req = c->head;
+    c->head = req->next;
+    if (!c->head)
+    {
+        c->tail = NULL;
+    }
+    c->depth--;
+    c->queued_bytes -= req->len;
+    c->deficit -= req->len;
+    c->tokens -= (double)req->len;
+    s->pending_packets--;
+
+    pthread_mutex_unlock(&s->mutex);
+    int result = s->commit(req->data, req->len, s->commit_arg);
+    if (req->done)
+    {
+        req->done(result, req->done_arg);
+    }
+    pthread_mutex_lock(&s->mutex);
+
+    if (result == 0)
+    {
+        s->committed_packets++;
+        s->committed_bytes += req->len;
+    }
+    else
+    {
+        s->failed_packets++;
+    }
+    free(req);
+}
+
+/* Put a submitted request on its client's queue. Called with mutex held. */
+static void ws_enqueue(write_sched_t *s, ws_request_t *req)
+{
+    ws_client_t *c = ws_client_get(s, req->key);
+    if (!c)
+    {
+        if (req->done)
+        {
+            req->done(-1, req->done_arg);
+        }
+        s->failed_packets++;
+        free(req);
+        return;
+    }
+    req->next = NULL;
+    if (c->tail)
+    {
+        c->tail->next = req;
+    }
+    else
+    {
+        c->head = req;
+    }
+    c->tail = req;
+    c->depth++;
+    c->queued_bytes += req->len;
+    s->pending_packets++;
+    if (c->depth > s->max_client_depth)
+    {
+        s->max_client_depth = c->depth;
+    }
+
+    if (!c->active)
+    {
+        c->active = 1;
+        s->active_count++;
+        ws_active_push(s, c);
+    }
+}
+
+static void ws_drain_inbox(write_sched_t *s)
+{
+    void *batch[WS_DRAIN_BATCH];
+    size_t n;
+
+    while ((n = aesd_mpsc_ring_pop_batch(&s->inbox, batch, WS_DRAIN_BATCH)) > 0)
+    {
+        for (size_t i = 0; i < n; i++)
+        {
+            ws_enqueue(s, batch[i]);
+        }
+    }
+}
+
+/*
+ * Sleep on cond until signalled or until deadline (NULL for none), unless a
+ * request is already waiting in the inbox. Called with mutex held.
+ * idle is raised before the inbox is checked and submitters check it after
+ * pushing, so either the committer sees the request or the submitter sees
+ * idle and signals.
+ */
+static void ws_wait(write_sched_t *s, const struct timespec *deadline)
+{
+    atomic_store(&s->idle, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (aesd_mpsc_ring_empty(&s->inbox))
+    {
+        if (deadline)
+        {
+            pthread_cond_timedwait(&s->cond, &s->mutex, deadline);
+        }
+        else
+        {
+            pthread_cond_wait(&s->cond, &s->mutex);
+        }
+    }
+    atomic_store(&s->idle, 0);
+}
+
+static void *ws_committer(void *arg)
+{
+    write_sched_t *s = arg;
+    size_t blocked_turns = 0;
+    uint64_t min_wait_ns = 0;
+
+    pthread_mutex_lock(&s->mutex);
+    for (;;)
+    {
+        ws_drain_inbox(s);
+        if (!s->active_head)
+        {
+            /* After shutdown, stop once no submitter can still push */
+            if (atomic_load(&s->shutdown) && atomic_load(&s->submitting) == 0 &&
+                aesd_mpsc_ring_empty(&s->inbox))
+            {
+                break;
+            }
+            ws_wait(s, NULL);
+            continue;
+        }
+
+        uint64_t now = ws_now_ns();
+        ws_client_t *c = ws_active_pop(s);
+        ws_refill(s, c, now);
+
+        uint64_t wait_ns = ws_rate_wait_ns(s, c, c->head->len);
+        if (wait_ns)
+        {
+            /* Rate limited: skip this turn without earning a quantum */
+            s->rate_limited_turns++;
+            ws_active_push(s, c);
+            if (!blocked_turns || wait_ns < min_wait_ns)
+            {
+                min_wait_ns = wait_ns;
+            }
+            if (++blocked_turns >= s->active_count)
+            {
+                /* Every active client is over its limit; sleep until the first one may go */
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += (time_t)(min_wait_ns / 1000000000ULL);
+                ts.tv_nsec += (long)(min_wait_ns % 1000000000ULL);
+                if (ts.tv_nsec >= 1000000000L)
+                {
+                    ts.tv_sec++;
+                    ts.tv_nsec -= 1000000000L;
+                }
+                ws_wait(s, &ts);
+                blocked_turns = 0;
+            }
+            continue;
+        }
+        blocked_turns = 0;
+
+        c->deficit += s->quantum;
+        while (c->head && c->head->len <= c->deficit &&
+               ws_rate_wait_ns(s, c, c->head->len) == 0)
+        {
+            ws_commit_one(s, c);
+        }
+
+        if (c->head)
+        {
+            ws_active_push(s, c);
+        }
+        else
+        {
+            c->deficit = 0;
+            c->active = 0;
+            s->active_count--;
+            if (!s->rate_bytes_per_sec)
+            {
+                ws_client_free(s, c);
+            }
+        }
+        if (s->rate_bytes_per_sec)
+        {
+            ws_sweep_idle(s, now);
+        }
+    }
+    pthread_mutex_unlock(&s->mutex);
+    return NULL;
+}
+
+write_sched_t *ws_create(ws_commit_fn commit, void *commit_arg, size_t quantum)
+{
+    write_sched_t *s = calloc(1, sizeof(*s));
+    if (!s)
+    {
+        return NULL;
+    }
+    s->commit = commit;
+    s->commit_arg = commit_arg;
+    s->quantum = quantum ? quantum : WS_DEFAULT_QUANTUM;
+    if (aesd_mpsc_ring_init(&s->inbox, WS_INBOX_SLOTS) != 0)
+    {
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->committer, NULL, ws_committer, s) != 0)
+    {
+        pthread_cond_destroy(&s->cond);
+        pthread_mutex_destroy(&s->mutex);
+        aesd_mpsc_ring_destroy(&s->inbox);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+/* Commits everything still queued, then stops the committer thread. */
+void ws_destroy(write_sched_t *s)
+{
+    if (!s)
+    {
+        return;
+    }
+    pthread_mutex_lock(&s->mutex);
+    atomic_store(&s->shutdown, 1);
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    pthread_join(s->committer, NULL);
+
+    for (size_t b = 0; b < WS_HASH_BUCKETS; b++)
+    {
+        ws_client_t *c = s->buckets[b];
+        while (c)
+        {
+            ws_client_t *next = c->hash_next;
+            free(c);
+            c = next;
+        }
+    }
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->mutex);
+    aesd_mpsc_ring_destroy(&s->inbox);
+    free(s);
+}
+
+void ws_set_rate_limit(write_sched_t *s, size_t bytes_per_sec, size_t burst)
+{
+    pthread_mutex_lock(&s->mutex);
+    s->rate_bytes_per_sec = bytes_per_sec;
+    s->rate_burst = burst ? burst : bytes_per_sec;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static void ws_wake_committer(write_sched_t *s)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&s->idle))
+    {
+        pthread_mutex_lock(&s->mutex);
+        pthread_cond_signal(&s->cond);
+        pthread_mutex_unlock(&s->mutex);
+    }
+}
+
+/* data must stay valid until done is called. */
+int ws_submit_async(write_sched_t *s, const char *client_key, const char *data, size_t len,
+                    ws_done_fn done, void *done_arg)
+{
+    ws_request_t *req = malloc(sizeof(*req));
+    if (!req)
+    {
+        return -1;
+    }
+    strncpy(req->key, client_key, WS_KEY_MAX - 1);
+    req->key[WS_KEY_MAX - 1] = '\0';
+    req->data = data;
+    req->len = len;
+    req->done = done;
+    req->done_arg = done_arg;
+    req->next = NULL;
+
+    /* Counted in submitting before the shutdown check, so ws_destroy waits for the push */
+    atomic_fetch_add(&s->submitting, 1);
+    if (atomic_load(&s->shutdown))
+    {
+        atomic_fetch_sub(&s->submitting, 1);
+        free(req);
+        return -1;
+    }
+    while (!aesd_mpsc_ring_push(&s->inbox, req))
+    {
+        /* Full: the committer is behind, make sure it is not asleep */
+        ws_wake_committer(s);
+        sched_yield();
+    }
+    atomic_fetch_sub(&s->submitting, 1);
+    ws_wake_committer(s);
+    return 0;
+}
+
+static void ws_waiter_done(int result, void *arg)
+{
+    ws_waiter_t *w = arg;
+    pthread_mutex_lock(&w->mutex);
+    w->result = result;
+    w->complete = 1;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+int ws_submit(write_sched_t *s, const char *client_key, const char *data, size_t len)
+{
+    ws_waiter_t w = { .complete = 0, .result = -1 };
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.cond, NULL);
+
+    int ret = ws_submit_async(s, client_key, data, len, ws_waiter_done, &w);
+    if (ret == 0)
+    {
+        pthread_mutex_lock(&w.mutex);
+        while (!w.complete)
+        {
+            pthread_cond_wait(&w.cond, &w.mutex);
+        }
+        pthread_mutex_unlock(&w.mutex);
+        ret = w.result;
+    }
+
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.mutex);
+    return ret;
+}
+
+void ws_log_metrics(write_sched_t *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    syslog(LOG_INFO, "write scheduler: clients=%zu active=%zu pending=%zu max_depth=%zu "
+           "committed=%llu bytes=%llu failed=%llu rate_limited_turns=%llu",
+           s->clients, s->active_count, s->pending_packets, s->max_client_depth,
+           (unsigned long long)s->committed_packets, (unsigned long long)s->committed_bytes,
+           (unsigned long long)s->failed_packets, (unsigned long long)s->rate_limited_turns);
+    for (ws_client_t *c = s->active_head; c; c = c->active_next)
+    {
+        syslog(LOG_INFO, "write scheduler: client %s depth=%zu queued_bytes=%zu deficit=%zu",
+               c->key, c->depth, c->queued_bytes, c->deficit);
+    }
+    pthread_mutex_unlock(&s->mutex);
+}
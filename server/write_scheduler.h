@@ -0,0 +1,49 @@
+#ifndef WRITE_SCHEDULER_H
+#define WRITE_SCHEDULER_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Fair scheduler in front of the device commit.
+ *
+ * Every client (keyed by a string, normally its peer address) gets its own
+ * FIFO of pending packets.  A single committer thread drains the queues with
+ * deficit round-robin by bytes, so one client uploading huge packets can
+ * only hold the device for its share of each round.  An optional token
+ * bucket limits the bytes per second committed for each client.
+ */
+
+typedef struct write_sched write_sched_t;
+
+/* Called by the committer thread for each packet. Returns 0 on success. */
+typedef int (*ws_commit_fn)(const char *data, size_t len, void *arg);
+
+/* Called by the committer thread once a packet has been committed (or failed). */
+typedef void (*ws_done_fn)(int result, void *arg);
+
+/* Create/destroy. quantum is the number of bytes added to a client's deficit each round (0 for default). */
+write_sched_t *ws_create(ws_commit_fn commit, void *commit_arg, size_t quantum);
+void ws_destroy(write_sched_t *sched);
+
+/* Per-client rate limit applied to every client, bytes/s and burst bytes. 0 disables. */
+void ws_set_rate_limit(write_sched_t *sched, size_t bytes_per_sec, size_t burst);
+
+/* Queue a packet; done is invoked from the committer thread. Returns 0 on success, -1 on failure. */
+int ws_submit_async(write_sched_t *sched, const char *client_key, const char *data, size_t len,
+                    ws_done_fn done, void *done_arg);
+
+/* Queue a packet and wait until it has been committed. Returns the commit result. */
+int ws_submit(write_sched_t *sched, const char *client_key, const char *data, size_t len);
+
+/* Log per-client queue depth and totals to syslog. */
+void ws_log_metrics(write_sched_t *sched);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* WRITE_SCHEDULER_H */
@@ -0,0 +1,126 @@
+#include "unity.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include "../../aesd-char-driver/aesd-ring.h"
+
+AESD_RING_DEFINE(ring1, uint32_t, 1)
+AESD_RING_DEFINE(ring8, uint32_t, 8)
+AESD_RING_DEFINE(ring10, uint32_t, 10)
+
+#define MODEL_MAX 64
+
+/* Reference FIFO the rings are checked against, holding the values pushed so far */
+typedef struct
+{
+    uint32_t value[MODEL_MAX];
+    uint32_t first;
+    uint32_t count;
+} model_t;
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+/*
+ * Fill, overwrite, drain and refill the ring, then run random pushes and
+ * pops against the model, comparing every live element after each step.
+ * A macro since every ring capacity is its own set of functions.
+ */
+#define CHECK_RING(name, capacity)                                                          \
+do                                                                                          \
+{                                                                                           \
+    struct name ring;                                                                       \
+    model_t model = { .first = 0, .count = 0 };                                             \
+    uint32_t next = 0, index, *elem;                                                        \
+                                                                                            \
+    name##_init(&ring);                                                                     \
+    TEST_ASSERT_EQUAL_UINT32(0, name##_count(&ring));                                       \
+    TEST_ASSERT_FALSE(name##_full(&ring));                                                  \
+    TEST_ASSERT_NULL(name##_oldest(&ring));                                                 \
+    TEST_ASSERT_NULL(name##_newest(&ring));                                                 \
+    TEST_ASSERT_NULL(name##_pop(&ring));                                                    \
+                                                                                            \
+    for (uint32_t step = 0; step < 4000; step++)                                            \
+    {                                                                                       \
+        /* Runs of pushes past full, then of pops past empty, then random */                \
+        bool push = step < 4 * (capacity) ? true                                            \
+                    : step < 6 * (capacity) ? false                                         \
+                    : next_random() % 2 == 0;                                               \
+        if (push)                                                                           \
+        {                                                                                   \
+            bool was_full = name##_full(&ring);                                             \
+            TEST_ASSERT_EQUAL_INT(model.count == (capacity), was_full);                     \
+            TEST_ASSERT_EQUAL_UINT32(next, *name##_push(&ring, &next));                     \
+            if (was_full)                                                                   \
+            {                                                                               \
+                model.first++;                                                              \
+                model.count--;                                                              \
+            }                                                                               \
+            model.value[(model.first + model.count++) % MODEL_MAX] = next++;                \
+        }                                                                                   \
+        else if (model.count == 0)                                                          \
+        {                                                                                   \
+            TEST_ASSERT_NULL(name##_pop(&ring));                                            \
+        }                                                                                   \
+        else                                                                                \
+        {                                                                                   \
+            elem = name##_pop(&ring);                                                       \
+            TEST_ASSERT_NOT_NULL(elem);                                                     \
+            TEST_ASSERT_EQUAL_UINT32(model.value[model.first++ % MODEL_MAX], *elem);        \
+            model.count--;                                                                  \
+        }                                                                                   \
+                                                                                            \
+        TEST_ASSERT_EQUAL_UINT32(model.count, name##_count(&ring));                         \
+        TEST_ASSERT_EQUAL_INT(model.count == (capacity), name##_full(&ring));               \
+        if (model.count == 0)                                                               \
+        {                                                                                   \
+            TEST_ASSERT_NULL(name##_oldest(&ring));                                         \
+            TEST_ASSERT_NULL(name##_newest(&ring));                                         \
+            continue;                                                                       \
+        }                                                                                   \
+        elem = name##_oldest(&ring);                                                        \
+        TEST_ASSERT_EQUAL_UINT32(model.value[model.first % MODEL_MAX], *elem);              \
+        TEST_ASSERT_EQUAL_UINT32(model.value[(model.first + model.count - 1) % MODEL_MAX],  \
+                                 *name##_newest(&ring));                                    \
+        AESD_RING_FOREACH(name, &ring, index, elem)                                         \
+        {                                                                                   \
+            TEST_ASSERT_EQUAL_UINT32(model.value[(model.first + index) % MODEL_MAX],        \
+                                     *elem);                                                \
+        }                                                                                   \
+        TEST_ASSERT_EQUAL_UINT32(model.count, index);                                       \
+    }                                                                                       \
+} while (0)
+
+void test_aesd_ring_capacity_one()
+{
+    CHECK_RING(ring1, 1);
+}
+
+void test_aesd_ring_power_of_two()
+{
+    CHECK_RING(ring8, 8);
+}
+
+void test_aesd_ring_non_power_of_two()
+{
+    CHECK_RING(ring10, 10);
+}
+
+void test_aesd_ring_wrap_helpers()
+{
+    TEST_ASSERT_EQUAL_UINT32(7, aesd_ring_mask(8));
+    TEST_ASSERT_EQUAL_UINT32(0, aesd_ring_mask(10));
+    for (uint32_t offs = 0; offs < 20; offs++)
+    {
+        TEST_ASSERT_EQUAL_UINT32(offs % 8, aesd_ring_wrap(offs, 8, aesd_ring_mask(8)));
+        TEST_ASSERT_EQUAL_UINT32(offs % 10, aesd_ring_wrap(offs, 10, aesd_ring_mask(10)));
+        TEST_ASSERT_EQUAL_UINT32(offs % 8, AESD_RING_WRAP_CONST(offs, 8u));
+        TEST_ASSERT_EQUAL_UINT32(offs % 10, AESD_RING_WRAP_CONST(offs, 10u));
+    }
+}
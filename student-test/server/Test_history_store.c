@@ -0,0 +1,331 @@
+#include "unity.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "../../server/history_store.h"
+
+typedef struct
+{
+    char *data;
+    size_t len;
+} collected_t;
+
+static int collect(const char *data, size_t len, void *arg)
+{
+    collected_t *c = arg;
+    char *grown = realloc(c->data, c->len + len + 1);
+    if (!grown)
+    {
+        return -1;
+    }
+    memcpy(grown + c->len, data, len);
+    c->data = grown;
+    c->len += len;
+    return 0;
+}
+
+/* Fresh store path with no history file or journal */
+static void temp_store_path(char *path, size_t size, char *journal, size_t journal_size)
+{
+    snprintf(path, size, "/tmp/Test_history_store.%d", (int)getpid());
+    snprintf(journal, journal_size, "%s.tail", path);
+    unlink(path);
+    unlink(journal);
+}
+
+/* Packet i of a test history, a line of varying length */
+static size_t make_packet(char *buf, unsigned int i)
+{
+    size_t len = (size_t)sprintf(buf, "packet %u ", i);
+    size_t pad = (i * 37) % 200;
+    memset(buf + len, 'a' + i % 26, pad);
+    len += pad;
+    buf[len++] = '\n';
+    return len;
+}
+
+static size_t expected_history(unsigned int packets, char **out)
+{
+    char packet[256];
+    collected_t c = { 0 };
+    for (unsigned int i = 0; i < packets; i++)
+    {
+        collect(packet, make_packet(packet, i), &c);
+    }
+    *out = c.data;
+    return c.len;
+}
+
+static void assert_history(const char *path, unsigned int packets)
+{
+    char *expected;
+    size_t expected_len = expected_history(packets, &expected);
+    collected_t c = { 0 };
+
+    history_store_t *hs = hs_open(path);
+    TEST_ASSERT_NOT_NULL(hs);
+    TEST_ASSERT_EQUAL_INT(0, hs_read(hs, collect, &c));
+    TEST_ASSERT_EQUAL_UINT(expected_len, c.len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, c.data, expected_len);
+    hs_close(hs);
+    free(c.data);
+    free(expected);
+}
+
+/* Appends packets [from, to) in a child that is then killed without closing the store */
+static void append_and_crash(const char *path, unsigned int from, unsigned int to)
+{
+    pid_t pid = fork();
+    TEST_ASSERT_TRUE(pid >= 0);
+    if (pid == 0)
+    {
+        char packet[256];
+        history_store_t *hs = hs_open(path);
+        if (!hs)
+        {
+            _exit(1);
+        }
+        for (unsigned int i = from; i < to; i++)
+        {
+            if (hs_append(hs, packet, make_packet(packet, i)) != 0)
+            {
+                _exit(1);
+            }
+        }
+        raise(SIGKILL);
+        _exit(1);
+    }
+    int status;
+    TEST_ASSERT_EQUAL_INT(pid, waitpid(pid, &status, 0));
+    TEST_ASSERT_TRUE_MESSAGE(WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL, "append failed");
+}
+
+void test_history_store_round_trip()
+{
+    char path[64], journal[80], packet[256];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    history_store_t *hs = hs_open(path);
+    TEST_ASSERT_NOT_NULL(hs);
+    for (unsigned int i = 0; i < 2000; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, hs_append(hs, packet, make_packet(packet, i)));
+    }
+    hs_close(hs);
+    TEST_ASSERT_EQUAL_INT_MESSAGE(-1, access(journal, F_OK), "journal left after a clean close");
+
+    assert_history(path, 2000);
+    unlink(path);
+}
+
+void test_history_store_survives_kill()
+{
+    char path[64], journal[80];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    /* Only the unsealed tail */
+    append_and_crash(path, 0, 10);
+    assert_history(path, 10);
+
+    /* Sealed blocks plus a tail, recovered on top of the previous run */
+    append_and_crash(path, 10, 1500);
+    assert_history(path, 1500);
+
+    unlink(path);
+    unlink(journal);
+}
+
+void test_history_store_drops_stale_journal()
+{
+    char path[64], journal[80], packet[256];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    append_and_crash(path, 0, 10);
+
+    /* As if the tail had been sealed but the crash came before the journal was emptied */
+    history_store_t *hs = hs_open(path);
+    TEST_ASSERT_NOT_NULL(hs);
+    for (unsigned int i = 10; i < 20; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, hs_append(hs, packet, make_packet(packet, i)));
+    }
+    int fd = open(journal, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    off_t journal_len = lseek(fd, 0, SEEK_END);
+    char *saved = malloc((size_t)journal_len);
+    TEST_ASSERT_EQUAL_INT(journal_len, pread(fd, saved, (size_t)journal_len, 0));
+    close(fd);
+    hs_close(hs);
+
+    fd = open(journal, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_EQUAL_INT(journal_len, write(fd, saved, (size_t)journal_len));
+    close(fd);
+    free(saved);
+
+    assert_history(path, 20);
+    unlink(path);
+}
+
+/* Whole contents of path into a malloc'd buffer */
+static char *read_file(const char *path, size_t *len)
+{
+    int fd = open(path, O_RDONLY);
+    TEST_ASSERT_TRUE(fd >= 0);
+    off_t size = lseek(fd, 0, SEEK_END);
+    char *data = malloc((size_t)size + 1);
+    TEST_ASSERT_EQUAL_INT(size, pread(fd, data, (size_t)size, 0));
+    close(fd);
+    *len = (size_t)size;
+    return data;
+}
+
+static void write_file(const char *path, const char *data, size_t len)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    TEST_ASSERT_TRUE(fd >= 0);
+    TEST_ASSERT_EQUAL_INT((int)len, write(fd, data, len));
+    close(fd);
+}
+
+void test_history_store_imports_plain_text()
+{
+    static const char text[] = "first packet\nsecond\nthird packet\n";
+    char path[64], journal[80], legacy[80];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+    snprintf(legacy, sizeof(legacy), "%s.legacy", path);
+    unlink(legacy);
+    write_file(path, text, sizeof(text) - 1);
+
+    /* Twice: the second open finds blocks and must not import again */
+    for (int round = 0; round < 2; round++)
+    {
+        collected_t c = { 0 };
+        history_store_t *hs = hs_open(path);
+        TEST_ASSERT_NOT_NULL(hs);
+        TEST_ASSERT_EQUAL_INT(0, hs_read(hs, collect, &c));
+        TEST_ASSERT_EQUAL_UINT(sizeof(text) - 1, c.len);
+        TEST_ASSERT_EQUAL_MEMORY(text, c.data, c.len);
+        hs_close(hs);
+        free(c.data);
+    }
+
+    size_t len;
+    char *kept = read_file(legacy, &len);
+    TEST_ASSERT_EQUAL_UINT(sizeof(text) - 1, len);
+    TEST_ASSERT_EQUAL_MEMORY(text, kept, len);
+    free(kept);
+    unlink(legacy);
+    unlink(path);
+}
+
+void test_history_store_keeps_corrupt_file()
+{
+    char path[64], journal[80], packet[256];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    /* Three sealed blocks and a tail */
+    history_store_t *hs = hs_open(path);
+    TEST_ASSERT_NOT_NULL(hs);
+    for (unsigned int i = 0; i < 2000; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, hs_append(hs, packet, make_packet(packet, i)));
+    }
+    hs_close(hs);
+
+    /* Break the magic of the second block */
+    size_t len;
+    char *data = read_file(path, &len);
+    uint32_t comp_len = (uint8_t)data[8] | (uint8_t)data[9] << 8 | (uint8_t)data[10] << 16 |
+                        (uint32_t)(uint8_t)data[11] << 24;
+    size_t second = HS_HEADER_SIZE + comp_len;
+    TEST_ASSERT_TRUE(second + HS_HEADER_SIZE < len);
+    data[second] ^= 0x55;
+    write_file(path, data, len);
+
+    TEST_ASSERT_NULL(hs_open(path));
+    size_t after_len;
+    char *after = read_file(path, &after_len);
+    TEST_ASSERT_EQUAL_UINT(len, after_len);
+    TEST_ASSERT_EQUAL_MEMORY(data, after, len);
+    free(after);
+    free(data);
+    unlink(path);
+    unlink(journal);
+}
+
+void test_history_store_drops_torn_seal()
+{
+    char path[64], journal[80], packet[256], block[HS_HEADER_SIZE + 64];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    /* A tail in the journal whose seal was cut short after 20 bytes */
+    append_and_crash(path, 0, 10);
+    size_t raw_len = make_packet(packet, 0);
+    TEST_ASSERT_TRUE(hs_encode_block(packet, raw_len, block) > 20);
+    write_file(path, block, 20);
+
+    assert_history(path, 10);
+    unlink(path);
+}
+
+void test_history_store_journal_compresses()
+{
+    char path[64], journal[80], *expected;
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    /* Stays within one tail block, so every byte is only in the journal */
+    append_and_crash(path, 0, 300);
+    size_t raw_len = expected_history(300, &expected);
+    free(expected);
+    TEST_ASSERT_TRUE(raw_len < HS_BLOCK_SIZE);
+    size_t journal_len;
+    char *saved = read_file(journal, &journal_len);
+    TEST_ASSERT_TRUE_MESSAGE(journal_len < raw_len / 2, "journal did not compress");
+
+    /* A record torn by the crash is dropped along with everything after it */
+    write_file(journal, saved, journal_len - 3);
+    free(saved);
+    assert_history(path, 299);
+    unlink(path);
+}
+
+/* Takes a fixed number of chunks, then fails */
+static int take_chunks(const char *data, size_t len, void *arg)
+{
+    (void)data;
+    (void)len;
+    unsigned int *left = arg;
+    return (*left)-- > 0 ? 0 : -1;
+}
+
+void test_history_store_stream_reports_stop()
+{
+    char path[64], journal[80], packet[256];
+    temp_store_path(path, sizeof(path), journal, sizeof(journal));
+
+    history_store_t *hs = hs_open(path);
+    TEST_ASSERT_NOT_NULL(hs);
+    for (unsigned int i = 0; i < 2000; i++)
+    {
+        TEST_ASSERT_EQUAL_INT(0, hs_append(hs, packet, make_packet(packet, i)));
+    }
+
+    /* Failing in a sealed block, in the tail, and never */
+    unsigned int left = 0;
+    TEST_ASSERT_EQUAL_INT(-1, hs_read(hs, take_chunks, &left));
+    left = 0;
+    TEST_ASSERT_EQUAL_INT(-1, hs_read_blocks(hs, take_chunks, &left));
+    left = 3;
+    TEST_ASSERT_EQUAL_INT(-1, hs_read(hs, take_chunks, &left));
+    left = 4;
+    TEST_ASSERT_EQUAL_INT(0, hs_read(hs, take_chunks, &left));
+    TEST_ASSERT_EQUAL_INT(0, left);
+    hs_close(hs);
+    unlink(path);
+}
@@ -0,0 +1,249 @@
+#include "unity.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/lz4block.h"
+#include "../../server/history_store.h"
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+static void fill_random(char *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = (char)next_random();
+    }
+}
+
+/* Lines of a small vocabulary, the shape aesdsocket history usually has */
+static void fill_text(char *buf, size_t len)
+{
+    static const char *words[] = { "aesd", "socket", "packet", "history", "block", "line" };
+    size_t i = 0;
+    while (i < len)
+    {
+        const char *w = words[next_random() % 6];
+        while (*w && i < len)
+        {
+            buf[i++] = *w++;
+        }
+        if (i < len)
+        {
+            buf[i++] = (next_random() % 8) ? ' ' : '\n';
+        }
+    }
+}
+
+/**
+* Compresses @param src, checks the result fits LZ4B_BOUND and decompresses back to the same bytes.
+* @return the compressed size
+*/
+static size_t round_trip(const char *src, size_t len)
+{
+    size_t bound = LZ4B_BOUND(len);
+    char *compressed = malloc(bound);
+    char *out = malloc(len ? len : 1);
+    TEST_ASSERT_NOT_NULL(compressed);
+    TEST_ASSERT_NOT_NULL(out);
+
+    size_t comp_len = lz4b_compress(src, len, compressed, bound);
+    TEST_ASSERT_TRUE_MESSAGE(comp_len > 0, "compress failed within LZ4B_BOUND");
+    TEST_ASSERT_TRUE(comp_len <= bound);
+    TEST_ASSERT_EQUAL_INT64((int64_t)len, lz4b_decompress(compressed, comp_len, out, len));
+    if (len)
+    {
+        TEST_ASSERT_EQUAL_MEMORY(src, out, len);
+    }
+
+    free(out);
+    free(compressed);
+    return comp_len;
+}
+
+void test_lz4block_empty()
+{
+    char out[1];
+    TEST_ASSERT_EQUAL_UINT(1, round_trip("", 0));
+    TEST_ASSERT_EQUAL_INT64(0, lz4b_decompress("", 0, out, sizeof(out)));
+}
+
+void test_lz4block_small_sizes()
+{
+    char buf[300];
+    for (size_t len = 1; len <= sizeof(buf); len++)
+    {
+        fill_random(buf, len);
+        round_trip(buf, len);
+        fill_text(buf, len);
+        round_trip(buf, len);
+        memset(buf, 'x', len);
+        round_trip(buf, len);
+    }
+}
+
+void test_lz4block_incompressible()
+{
+    char *buf = malloc(HS_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(buf);
+    fill_random(buf, HS_BLOCK_SIZE);
+    round_trip(buf, 4096);
+    round_trip(buf, 65535);
+    round_trip(buf, HS_BLOCK_SIZE);
+    free(buf);
+}
+
+void test_lz4block_full_block()
+{
+    char *buf = malloc(HS_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(buf);
+
+    fill_text(buf, HS_BLOCK_SIZE);
+    TEST_ASSERT_TRUE_MESSAGE(round_trip(buf, HS_BLOCK_SIZE) < HS_BLOCK_SIZE / 2, "text did not compress");
+
+    /* Long runs: overlapping matches and match lengths far past 15 */
+    memset(buf, 'a', HS_BLOCK_SIZE);
+    TEST_ASSERT_TRUE(round_trip(buf, HS_BLOCK_SIZE) < 512);
+
+    /* A period 32 pattern that changes every 40000 bytes */
+    fill_random(buf, 32);
+    for (size_t i = 32; i < HS_BLOCK_SIZE; i++)
+    {
+        buf[i] = buf[i % 32] ^ (char)(i / 40000);
+    }
+    round_trip(buf, HS_BLOCK_SIZE);
+    free(buf);
+}
+
+void test_lz4block_rejects_bad_input()
+{
+    char src[1000];
+    char compressed[LZ4B_BOUND(1000)];
+    char out[1000];
+
+    fill_text(src, sizeof(src));
+    size_t comp_len = lz4b_compress(src, sizeof(src), compressed, sizeof(compressed));
+    TEST_ASSERT_TRUE(comp_len > 0);
+
+    TEST_ASSERT_EQUAL_INT64(-1, lz4b_decompress(compressed, comp_len, out, sizeof(out) - 1));
+    for (size_t cut = 1; cut < comp_len; cut++)
+    {
+        /* A truncated stream either fails or yields a prefix, never more */
+        long n = lz4b_decompress(compressed, comp_len - cut, out, sizeof(out));
+        TEST_ASSERT_TRUE(n < (long)sizeof(src));
+    }
+    TEST_ASSERT_EQUAL_UINT(0, lz4b_compress(src, sizeof(src), compressed, 10));
+}
+
+void test_lz4block_encoded_block()
+{
+    char *raw = malloc(HS_BLOCK_SIZE);
+    char *encoded = malloc(HS_HEADER_SIZE + LZ4B_BOUND(HS_BLOCK_SIZE));
+    char *out = malloc(HS_BLOCK_SIZE);
+    TEST_ASSERT_NOT_NULL(raw);
+    TEST_ASSERT_NOT_NULL(encoded);
+    TEST_ASSERT_NOT_NULL(out);
+
+    for (int compressible = 0; compressible < 2; compressible++)
+    {
+        if (compressible)
+        {
+            fill_text(raw, HS_BLOCK_SIZE);
+        }
+        else
+        {
+            fill_random(raw, HS_BLOCK_SIZE);
+        }
+        size_t encoded_len = hs_encode_block(raw, HS_BLOCK_SIZE, encoded);
+        uint32_t comp_len = (uint8_t)encoded[8] | (uint8_t)encoded[9] << 8 |
+                            (uint8_t)encoded[10] << 16 | (uint32_t)(uint8_t)encoded[11] << 24;
+        TEST_ASSERT_EQUAL_UINT(HS_HEADER_SIZE + comp_len, encoded_len);
+        if (comp_len == HS_BLOCK_SIZE)
+        {
+            /* Stored as is */
+            TEST_ASSERT_FALSE(compressible);
+            TEST_ASSERT_EQUAL_MEMORY(raw, encoded + HS_HEADER_SIZE, HS_BLOCK_SIZE);
+        }
+        else
+        {
+            TEST_ASSERT_TRUE(compressible);
+            TEST_ASSERT_EQUAL_INT64(HS_BLOCK_SIZE,
+                    lz4b_decompress(encoded + HS_HEADER_SIZE, comp_len, out, HS_BLOCK_SIZE));
+            TEST_ASSERT_EQUAL_MEMORY(raw, out, HS_BLOCK_SIZE);
+        }
+    }
+    free(out);
+    free(encoded);
+    free(raw);
+}
+
+void test_lz4block_stream()
+{
+    char *raw = malloc(HS_BLOCK_SIZE);
+    char *out = malloc(HS_BLOCK_SIZE);
+    char *compressed = malloc(LZ4B_BOUND(HS_BLOCK_SIZE));
+    lz4b_stream_t *stream = malloc(sizeof(*stream));
+    TEST_ASSERT_NOT_NULL(raw);
+    TEST_ASSERT_NOT_NULL(out);
+    TEST_ASSERT_NOT_NULL(compressed);
+    TEST_ASSERT_NOT_NULL(stream);
+
+    /* Short pieces, mostly too short to compress on their own, decoded into a second buffer */
+    fill_text(raw, HS_BLOCK_SIZE);
+    lz4b_stream_reset(stream);
+    size_t pos = 0, total = 0, alone = 0;
+    while (pos < HS_BLOCK_SIZE)
+    {
+        size_t len = 1 + next_random() % 120;
+        if (len > HS_BLOCK_SIZE - pos)
+        {
+            len = HS_BLOCK_SIZE - pos;
+        }
+        size_t comp_len = lz4b_compress_next(stream, raw, pos, len, compressed, LZ4B_BOUND(len));
+        TEST_ASSERT_TRUE(comp_len > 0 && comp_len <= LZ4B_BOUND(len));
+        TEST_ASSERT_EQUAL_INT64((int64_t)len, lz4b_decompress_next(compressed, comp_len, out, pos, len));
+        TEST_ASSERT_EQUAL_MEMORY(raw + pos, out + pos, len);
+        total += comp_len;
+        alone += lz4b_compress(raw + pos, len, compressed, LZ4B_BOUND(len));
+        pos += len;
+    }
+    TEST_ASSERT_TRUE_MESSAGE(total < alone * 3 / 4, "pieces did not compress against earlier ones");
+
+    /* Loading decoded bytes lets a fresh stream continue where another left off */
+    lz4b_stream_reset(stream);
+    lz4b_stream_load(stream, raw, 0, 1000);
+    size_t comp_len = lz4b_compress_next(stream, raw, 1000, 500, compressed, LZ4B_BOUND(500));
+    memcpy(out, raw, 1000);
+    TEST_ASSERT_EQUAL_INT64(500, lz4b_decompress_next(compressed, comp_len, out, 1000, 500));
+    TEST_ASSERT_EQUAL_MEMORY(raw + 1000, out + 1000, 500);
+
+    free(stream);
+    free(compressed);
+    free(out);
+    free(raw);
+}
+
+void test_lz4block_stream_rejects_reference_before_start()
+{
+    char raw[256];
+    char compressed[LZ4B_BOUND(128)];
+    char out[256];
+    lz4b_stream_t *stream = malloc(sizeof(*stream));
+    TEST_ASSERT_NOT_NULL(stream);
+
+    memset(raw, 'q', sizeof(raw));
+    lz4b_stream_reset(stream);
+    lz4b_stream_load(stream, raw, 0, 128);
+    size_t comp_len = lz4b_compress_next(stream, raw, 128, 128, compressed, sizeof(compressed));
+    TEST_ASSERT_TRUE(comp_len > 0 && comp_len < 20);
+    /* Decoded at position 0 the back reference points before the buffer */
+    TEST_ASSERT_EQUAL_INT64(-1, lz4b_decompress_next(compressed, comp_len, out, 0, 128));
+    free(stream);
+}
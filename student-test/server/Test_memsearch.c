@@ -0,0 +1,143 @@
+#define _GNU_SOURCE
+#include "unity.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../../server/memsearch.h"
+
+static uint64_t rng_state = 0x2545f4914f6cdd1dull;
+
+static uint32_t next_random(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (uint32_t)rng_state;
+}
+
+/* Check memsearch against memmem for every needle of needle_len taken from haystack, plus one that is not in it */
+static void check_against_memmem(const char *haystack, size_t len, size_t needle_len)
+{
+    for (size_t at = 0; at + needle_len <= len; at++)
+    {
+        const char *needle = haystack + at;
+        TEST_ASSERT_EQUAL_PTR(memmem(haystack, len, needle, needle_len),
+                              memsearch(haystack, len, needle, needle_len));
+    }
+    char missing[64];
+    memset(missing, 'z', sizeof(missing));
+    TEST_ASSERT_NULL(memsearch(haystack, len, missing, needle_len));
+}
+
+void test_memsearch_needle_lengths()
+{
+    char haystack[200];
+    /* A small alphabet so that first/last byte candidates are common */
+    for (size_t i = 0; i < sizeof(haystack); i++)
+    {
+        haystack[i] = "abc"[next_random() % 3];
+    }
+    size_t lengths[] = { 1, 2, 3, 15, 16, 17, 31, 33, 64 };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        /* Every haystack length, so each needle also lands in the non-SIMD remainder */
+        for (size_t len = 0; len <= sizeof(haystack); len += 7)
+        {
+            check_against_memmem(haystack, len, lengths[i]);
+        }
+    }
+}
+
+void test_memsearch_match_at_end()
+{
+    char haystack[100];
+    const char *needles[] = { "Q", "QR", "QRSTUVWXYZ", "QRSTUVWXYZqrstuvw" };
+    for (size_t i = 0; i < sizeof(needles) / sizeof(needles[0]); i++)
+    {
+        size_t needle_len = strlen(needles[i]);
+        /* Matches in each of the last 16 positions, none of them reachable by a full 16 byte step */
+        for (size_t back = 0; back < 16; back++)
+        {
+            memset(haystack, '.', sizeof(haystack));
+            size_t at = sizeof(haystack) - needle_len - back;
+            memcpy(haystack + at, needles[i], needle_len);
+            TEST_ASSERT_EQUAL_PTR(haystack + at, memsearch(haystack, sizeof(haystack), needles[i], needle_len));
+            TEST_ASSERT_NULL(memsearch(haystack, sizeof(haystack) - back - 1, needles[i], needle_len));
+        }
+    }
+}
+
+void test_memsearch_edge_cases()
+{
+    const char *text = "hello";
+    TEST_ASSERT_EQUAL_PTR(text, memsearch(text, 5, "", 0));
+    TEST_ASSERT_EQUAL_PTR(text, memsearch(text, 5, "hello", 5));
+    TEST_ASSERT_NULL(memsearch(text, 5, "hello!", 6));
+    TEST_ASSERT_NULL(memsearch(text, 0, "h", 1));
+    /* First and last bytes match but the middle does not */
+    TEST_ASSERT_NULL(memsearch("axxxxxxxxxxxxxxxxxxxb", 21, "ayb", 3));
+}
+
+typedef struct
+{
+    uint32_t index[8];
+    char entry[8][32];
+    size_t found;
+    size_t stop_after;
+} entries_t;
+
+static int collect_entry(uint32_t index, const char *entry, size_t len, void *arg)
+{
+    entries_t *e = arg;
+    if (e->found == e->stop_after)
+    {
+        return -1;
+    }
+    TEST_ASSERT_TRUE(e->found < 8 && len < 32);
+    e->index[e->found] = index;
+    memcpy(e->entry[e->found], entry, len);
+    e->entry[e->found][len] = '\0';
+    e->found++;
+    return 0;
+}
+
+void test_memsearch_entries_numbering()
+{
+    const char *text = "apple\nbanana\ncherry pie\npie\napple pie pie\nfig";
+    entries_t e = { .stop_after = 8 };
+
+    TEST_ASSERT_EQUAL_UINT(3, memsearch_entries(text, strlen(text), "pie", 3, collect_entry, &e));
+    TEST_ASSERT_EQUAL_UINT(3, e.found);
+    TEST_ASSERT_EQUAL_UINT32(2, e.index[0]);
+    TEST_ASSERT_EQUAL_STRING("cherry pie\n", e.entry[0]);
+    TEST_ASSERT_EQUAL_UINT32(3, e.index[1]);
+    TEST_ASSERT_EQUAL_STRING("pie\n", e.entry[1]);
+    /* Two matches in one entry report it once */
+    TEST_ASSERT_EQUAL_UINT32(4, e.index[2]);
+    TEST_ASSERT_EQUAL_STRING("apple pie pie\n", e.entry[2]);
+
+    /* The first entry, and a last entry with no newline */
+    memset(&e, 0, sizeof(e));
+    e.stop_after = 8;
+    TEST_ASSERT_EQUAL_UINT(2, memsearch_entries(text, strlen(text), "appl", 4, collect_entry, &e));
+    TEST_ASSERT_EQUAL_UINT32(0, e.index[0]);
+    TEST_ASSERT_EQUAL_UINT32(4, e.index[1]);
+    memset(&e, 0, sizeof(e));
+    e.stop_after = 8;
+    TEST_ASSERT_EQUAL_UINT(1, memsearch_entries(text, strlen(text), "fig", 3, collect_entry, &e));
+    TEST_ASSERT_EQUAL_UINT32(5, e.index[0]);
+    TEST_ASSERT_EQUAL_STRING("fig", e.entry[0]);
+
+    memset(&e, 0, sizeof(e));
+    e.stop_after = 8;
+    TEST_ASSERT_EQUAL_UINT(0, memsearch_entries(text, strlen(text), "kiwi", 4, collect_entry, &e));
+}
+
+void test_memsearch_entries_stop()
+{
+    const char *text = "a1\na2\na3\na4\n";
+    entries_t e = { .stop_after = 2 };
+
+    TEST_ASSERT_EQUAL_UINT(2, memsearch_entries(text, strlen(text), "a", 1, collect_entry, &e));
+    TEST_ASSERT_EQUAL_UINT32(1, e.index[1]);
+}